@@ -1,11 +1,22 @@
 #include "ftp_client.h"
+#include "ftp_client_lib.h"
+#include "sparse_map.h"
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <glob.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
 
@@ -53,6 +64,44 @@ bool recv_to_stream(int sock, ostream &out, uint64_t n) {
     return true;
 }
 
+SockReader::SockReader(int sock, size_t capacity) : sock(sock), buf(capacity) {}
+
+bool SockReader::fill() {
+    pos = 0;
+    len = 0;
+    ssize_t r = recv(sock, buf.data(), buf.size(), 0);
+    if (r <= 0) return false;
+    len = (size_t)r;
+    return true;
+}
+
+bool SockReader::readLine(string &line) {
+    line.clear();
+    while (true) {
+        if (pos == len && !fill()) return false;
+        const char *start = buf.data() + pos;
+        const char *nl = (const char *)memchr(start, '\n', len - pos);
+        if (nl) {
+            line.append(start, nl - start);
+            pos += (nl - start) + 1;
+            return true;
+        }
+        line.append(start, len - pos);
+        pos = len;
+    }
+}
+
+bool SockReader::readToStream(ostream &out, uint64_t n) {
+    while (n > 0) {
+        if (pos == len && !fill()) return false;
+        size_t take = (size_t)min<uint64_t>(n, len - pos);
+        out.write(buf.data() + pos, take);
+        pos += take;
+        n -= take;
+    }
+    return true;
+}
+
 // expand ~ to HOME
 string expand_path(const string &path) {
     if (!path.empty() && path[0] == '~') {
@@ -62,54 +111,88 @@ string expand_path(const string &path) {
     return path;
 }
 
-void do_PUT(int sock, const string &localPath) {
-    string real = expand_path(localPath);
-    if (!fs::exists(real) || !fs::is_regular_file(real)) {
-        cerr << "ERROR: Cannot open file " << localPath << "\n";
-        return;
+// upload one local file under remoteName; on failure err is set and
+// connLost tells whether the socket is still usable
+bool put_file(int sock, const string &real, const string &remoteName, string &err, bool &connLost) {
+    connLost = false;
+    ifstream in(real, ios::binary);
+    if (!in.is_open() || !fs::is_regular_file(real)) {
+        err = "Cannot open file " + real;
+        return false;
     }
     uint64_t fsize = fs::file_size(real);
-    string remoteName = fs::path(real).filename().string();
 
     // send command
     if (!send_line(sock, string("PUT ") + remoteName)) {
-        cerr << "Send failed\n"; return;
+        err = "Send failed"; connLost = true; return false;
     }
 
     // expect READY
     string ready = recv_line(sock);
     if (ready.rfind("READY", 0) != 0) {
-        cerr << "Server error: " << ready << "\n";
-        return;
+        err = ready.empty() ? "No response" : "Server error: " + ready;
+        connLost = ready.empty();
+        return false;
     }
 
     // send SIZE
     if (!send_line(sock, string("SIZE ") + to_string((unsigned long long)fsize))) {
-        cerr << "Send failed\n"; return;
+        err = "Send failed"; connLost = true; return false;
     }
 
     // expect OK
     string ok = recv_line(sock);
     if (ok.rfind("OK", 0) != 0) {
-        cerr << "Server error: " << ok << "\n";
-        return;
+        err = ok.empty() ? "No response" : "Server error: " + ok;
+        connLost = ok.empty();
+        return false;
     }
 
-    // send file bytes
-    ifstream in(real, ios::binary);
+    // send file bytes; exactly fsize of them, the server counts
     char buf[BUFFER_SIZE];
-    while (in.read(buf, sizeof(buf)) || in.gcount() > 0) {
-        size_t toSend = (size_t)in.gcount();
-        if (!send_all(sock, buf, toSend)) { cerr << "Send failed\n"; in.close(); return; }
+    uint64_t left = fsize;
+    while (left > 0) {
+        size_t want = (size_t)min<uint64_t>(sizeof(buf), left);
+        in.read(buf, want);
+        size_t n = (size_t)in.gcount();
+        if (n == 0) {
+            // the file shrank: drop the connection so the server discards the upload
+            // (shutdown, not close: the caller still owns the descriptor)
+            shutdown(sock, SHUT_RDWR);
+            err = "Local file ended early, connection closed";
+            connLost = true;
+            return false;
+        }
+        if (!send_all(sock, buf, n)) { err = "Send failed"; connLost = true; return false; }
+        left -= n;
     }
     in.close();
 
     // wait final OK
     string final = recv_line(sock);
-    if (final.rfind("OK", 0) == 0) {
+    if (final.rfind("OK", 0) != 0) {
+        err = final.empty() ? "No response" : "Server response: " + final;
+        connLost = final.empty();
+        return false;
+    }
+    return true;
+}
+
+void do_PUT(int sock, const string &localPath) {
+    string real = expand_path(localPath);
+    if (!fs::exists(real) || !fs::is_regular_file(real)) {
+        cerr << "ERROR: Cannot open file " << localPath << "\n";
+        return;
+    }
+    uint64_t fsize = fs::file_size(real);
+    string remoteName = fs::path(real).filename().string();
+
+    string err;
+    bool connLost = false;
+    if (put_file(sock, real, remoteName, err, connLost)) {
         cout << "File uploaded: " << remoteName << " (" << fsize << " bytes)\n";
     } else {
-        cout << "Server response: " << final << "\n";
+        cerr << err << "\n";
     }
 }
 
@@ -142,30 +225,509 @@ void do_GET_common(int sock, const string &cmd, const string &arg) {
     cout << "File downloaded: " << localName << " (" << fsize << " bytes)\n";
 }
 
-void do_LIST_like(int sock, const string &cmd) {
-    // cmd: LIST or LISTALL or HELP
-    if (!send_line(sock, cmd)) { cerr << "Send failed\n"; return; }
+// PUT that sends only the data extents; holes stay holes on the server
+void do_PUTSPARSE(int sock, const string &localPath) {
+    string real = expand_path(localPath);
+    int fd = open(real.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        cerr << "ERROR: Cannot open file " << localPath << "\n";
+        return;
+    }
+    uint64_t fsize = (uint64_t)st.st_size;
+    vector<Extent> extents = dataExtents(fd, fsize);
+    string remoteName = fs::path(real).filename().string();
+
+    auto fail = [fd](const string &msg) {
+        close(fd);
+        cerr << msg << "\n";
+    };
+    if (!send_line(sock, "PUTSPARSE " + remoteName)) return fail("Send failed");
+    string ready = recv_line(sock);
+    if (ready.rfind("READY", 0) != 0) return fail(ready.empty() ? "No response" : "Server error: " + ready);
+
+    // the first map line goes as SIZE; the rest only once the server accepted it
+    string map = extentMap(fsize, extents);
+    size_t nl = map.find('\n');
+    if (!send_line(sock, "SIZE " + map.substr(0, nl))) return fail("Send failed");
+    string ok = recv_line(sock);
+    if (ok.rfind("OK", 0) != 0) return fail(ok.empty() ? "No response" : "Server error: " + ok);
+    if (!send_all(sock, map.data() + nl + 1, map.size() - nl - 1)) return fail("Send failed");
+
+    vector<char> buf((size_t)min<uint64_t>(max<uint64_t>(extentBytes(extents), 1), STREAM_BUFFER_SIZE));
+    for (const Extent &e : extents) {
+        for (uint64_t off = 0; off < e.length;) {
+            size_t want = (size_t)min<uint64_t>(buf.size(), e.length - off);
+            ssize_t n = pread(fd, buf.data(), want, (off_t)(e.offset + off));
+            if (n <= 0) {
+                // shrank since the map was made: the announced bytes still have to go out
+                memset(buf.data(), 0, want);
+                n = (ssize_t)want;
+            }
+            if (!send_all(sock, buf.data(), (size_t)n)) return fail("Send failed");
+            off += (uint64_t)n;
+        }
+    }
+    close(fd);
+
+    string final = recv_line(sock);
+    if (final.rfind("OK", 0) != 0) {
+        cerr << (final.empty() ? "No response" : "Server response: " + final) << "\n";
+        return;
+    }
+    cout << "File uploaded: " << remoteName << " (" << fsize << " bytes, " << extentBytes(extents) << " of data in "
+         << extents.size() << " extents)\n";
+}
+
+// GET that receives the extent map and writes only the data, leaving holes
+void do_GETSPARSE(int sock, const string &arg) {
+    if (!send_line(sock, "GETSPARSE " + arg)) { cerr << "Send failed\n"; return; }
+
     string header = recv_line(sock);
     if (header.empty()) { cerr << "No response\n"; return; }
-    if (header.rfind("ERROR", 0) == 0) {
+    if (header.rfind("OK", 0) != 0) {
         cout << header << "\n";
         return;
     }
-    if (header.rfind("OK", 0) != 0) {
-        cout << header << "\n";
+    SockReader in(sock);
+    string line;
+    uint64_t fsize = 0, count = 0;
+    if (!in.readLine(line) || !parseNumberPair(line, fsize, count) || count > SPARSE_MAX_EXTENTS) {
+        cerr << "Bad extent map\n";
         return;
     }
+    vector<Extent> extents;
+    uint64_t end = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        Extent e;
+        if (!in.readLine(line) || !parseExtent(line, fsize, end, e)) { cerr << "Bad extent map\n"; return; }
+        extents.push_back(e);
+    }
+
+    string localName = fs::path(arg).filename().string();
+    ofstream out(localName, ios::binary);
+    if (!out.is_open()) { cerr << "Cannot create local file\n"; return; }
+    for (const Extent &e : extents) {
+        // seeking past the end leaves the gap unallocated
+        out.seekp((streamoff)e.offset);
+        if (!in.readToStream(out, e.length)) { cerr << "Receive failed\n"; return; }
+    }
+    out.close();
+    error_code ec;
+    fs::resize_file(localName, fsize, ec);
+    if (!out || ec) { cerr << "Cannot write local file\n"; return; }
+    cout << "File downloaded: " << localName << " (" << fsize << " bytes, " << extentBytes(extents) << " of data in "
+         << extents.size() << " extents)\n";
+}
+
+// read an "OK\n<size>\n<text>" reply; otherwise returns false with the reply
+// line (or a local error) in status
+bool recv_text_block(int sock, string &text, string &status) {
+    status = recv_line(sock);
+    if (status.empty()) { status = "No response"; return false; }
+    if (status.rfind("OK", 0) != 0) return false;
     string sizeLine = recv_line(sock);
     uint64_t sz = 0;
-    try { sz = stoull(sizeLine); } catch (...) { cerr << "Bad size\n"; return; }
-    // read and output to stdout
-    string outText;
-    outText.resize(sz);
+    try { sz = stoull(sizeLine); } catch (...) { status = "Bad size"; return false; }
+    text.resize(sz);
     size_t got = 0;
     while (got < sz) {
-        ssize_t r = recv(sock, &outText[got], sz - got, 0);
-        if (r <= 0) break;
+        ssize_t r = recv(sock, &text[got], sz - got, 0);
+        if (r <= 0) { status = "Receive failed"; text.resize(got); return false; }
         got += r;
     }
+    return true;
+}
+
+void do_LIST_like(int sock, const string &cmd) {
+    // cmd: HELP or STATS or USAGE, or a whole LIST/LISTALL/FIND line
+    if (!send_line(sock, cmd)) { cerr << "Send failed\n"; return; }
+    string outText, status;
+    if (!recv_text_block(sock, outText, status)) {
+        cout << status << "\n";
+        return;
+    }
+    // output to stdout
     cout << outText;
+}
+
+// WATCH [dir]: print the pushed change batches until a line is typed (or stdin
+// ends), then UNWATCH and wait for the server's OK
+void do_WATCH(int sock, const string &line) {
+    if (!send_line(sock, line)) { cerr << "Send failed\n"; return; }
+    string resp = recv_line(sock);
+    if (resp.empty()) { cout << "No response from server\n"; return; }
+    if (resp != "OK") { cout << resp << "\n"; return; }
+    cout << recv_line(sock) << " (press Enter to stop)\n";
+
+    bool stopping = false;
+    while (true) {
+        struct pollfd fds[2] = {{sock, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+        if (poll(fds, stopping ? 1 : 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (!stopping && fds[1].revents) {
+            string typed;
+            getline(cin, typed);
+            if (!send_line(sock, "UNWATCH")) { cerr << "Send failed\n"; return; }
+            stopping = true;
+        }
+        if (!fds[0].revents) continue;
+        string msg = recv_line(sock);
+        if (msg.empty()) { cout << "Connection closed\n"; return; }
+        if (msg == "OK") {
+            // only ever the answer to our UNWATCH
+            cout << recv_line(sock) << "\n";
+            return;
+        }
+        if (msg.rfind("EVENTS ", 0) == 0) {
+            uint64_t n = 0;
+            try { n = stoull(msg.substr(7)); } catch (...) { cerr << "Bad event batch\n"; return; }
+            for (uint64_t i = 0; i < n; ++i) cout << recv_line(sock) << "\n";
+        } else if (msg == "RESYNC") {
+            cout << "RESYNC (events were dropped, list the directory again)\n";
+        } else {
+            cout << msg << "\n";
+        }
+    }
+}
+
+// same check as the server: no root, no "..", not empty
+static bool safeRelativePath(const string &rel) {
+    if (rel.empty() || rel[0] == '/') return false;
+    for (const auto &part : fs::path(rel)) {
+        if (part == "..") return false;
+    }
+    return true;
+}
+
+void do_PUTDIR(int sock, const string &localDir) {
+    string real = expand_path(localDir);
+    if (!fs::is_directory(real)) {
+        cerr << "ERROR: Not a directory " << localDir << "\n";
+        return;
+    }
+    fs::path root = fs::path(real).lexically_normal();
+    if (root.filename().empty()) root = root.parent_path(); // trailing '/'
+    string remoteName = root.filename().string();
+
+    if (!send_line(sock, "PUTDIR " + remoteName)) { cerr << "Send failed\n"; return; }
+    string ready = recv_line(sock);
+    if (ready.rfind("READY", 0) != 0) {
+        cerr << "Server error: " << ready << "\n";
+        return;
+    }
+
+    // one stream for the whole tree; headers and small files share send buffers
+    string out;
+    out.reserve(STREAM_BUFFER_SIZE + BUFFER_SIZE);
+    bool sendOk = true;
+    auto flush = [&]() {
+        if (sendOk && !send_all(sock, out.data(), out.size())) sendOk = false;
+        out.clear();
+    };
+
+    uint64_t files = 0, bytes = 0;
+    error_code ec;
+    for (auto it = fs::recursive_directory_iterator(root, ec); sendOk && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) break;
+        string rel = it->path().lexically_relative(root).generic_string();
+        if (it->is_directory()) {
+            out += "D " + rel + "\n";
+        } else if (it->is_regular_file()) {
+            ifstream in(it->path(), ios::binary);
+            if (!in.is_open()) continue;
+            uint64_t fsize = it->file_size();
+            out += "F " + to_string((unsigned long long)fsize) + " " + rel + "\n";
+            // always emit exactly fsize bytes, even if the file changed meanwhile
+            uint64_t left = fsize;
+            char buf[STREAM_BUFFER_SIZE / 4];
+            while (left > 0) {
+                size_t want = (size_t)min<uint64_t>(sizeof(buf), left);
+                in.read(buf, want);
+                size_t n = (size_t)in.gcount();
+                if (n == 0) { memset(buf, 0, want); n = want; }
+                out.append(buf, n);
+                left -= n;
+                if (out.size() >= STREAM_BUFFER_SIZE) flush();
+            }
+            ++files;
+            bytes += fsize;
+        }
+        if (out.size() >= STREAM_BUFFER_SIZE) flush();
+    }
+    out += "END\n";
+    flush();
+    if (!sendOk) { cerr << "Send failed\n"; return; }
+
+    string status = recv_line(sock);
+    if (status.rfind("OK", 0) == 0) {
+        cout << "Directory uploaded: " << remoteName << " (" << recv_line(sock) << ")\n";
+    } else {
+        cout << "Server response: " << status << "\n";
+    }
+}
+
+void do_GETDIR(int sock, const string &remoteDir) {
+    if (!send_line(sock, "GETDIR " + remoteDir)) { cerr << "Send failed\n"; return; }
+
+    SockReader in(sock);
+    string line;
+    if (!in.readLine(line)) { cerr << "No response\n"; return; }
+    if (line.rfind("OK", 0) != 0) {
+        cout << line << "\n";
+        return;
+    }
+
+    fs::path localRoot = fs::path(remoteDir).lexically_normal();
+    if (localRoot.filename().empty()) localRoot = localRoot.parent_path();
+    localRoot = localRoot.filename();
+    if (localRoot.empty() || localRoot == "." || localRoot == "..") localRoot = "download";
+    error_code ec;
+    fs::create_directories(localRoot, ec);
+
+    uint64_t files = 0, bytes = 0, skipped = 0;
+    while (true) {
+        if (!in.readLine(line)) { cerr << "Receive failed\n"; return; }
+        if (line == "END") break;
+        if (line.size() < 3 || line[1] != ' ') { cerr << "Bad stream entry\n"; return; }
+
+        if (line[0] == 'D') {
+            string rel = line.substr(2);
+            if (safeRelativePath(rel)) fs::create_directories(localRoot / rel, ec);
+        } else if (line[0] == 'F') {
+            size_t sp = line.find(' ', 2);
+            uint64_t fsize = 0;
+            try { fsize = stoull(line.substr(2, sp - 2)); } catch (...) { cerr << "Bad size\n"; return; }
+            string rel = sp == string::npos ? string() : line.substr(sp + 1);
+
+            ofstream out;
+            if (safeRelativePath(rel)) {
+                fs::create_directories((localRoot / rel).parent_path(), ec);
+                out.open(localRoot / rel, ios::binary);
+            }
+            if (!out.is_open()) {
+                ++skipped;
+                ofstream devnull("/dev/null", ios::binary);
+                if (!in.readToStream(devnull, fsize)) { cerr << "Receive failed\n"; return; }
+                continue;
+            }
+            if (!in.readToStream(out, fsize)) { cerr << "Receive failed\n"; return; }
+            ++files;
+            bytes += fsize;
+        } else {
+            cerr << "Bad stream entry\n";
+            return;
+        }
+    }
+    cout << "Directory downloaded: " << localRoot.string() << " (" << files << " files, " << bytes << " bytes";
+    if (skipped) cout << ", " << skipped << " skipped";
+    cout << ")\n";
+}
+
+// open a TCP connection to the server; -1 on failure
+int connect_to_server(const string &ip, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+
+    sockaddr_in srv{};
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &srv.sin_addr) != 1 ||
+        connect(sock, (sockaddr *)&srv, sizeof(srv)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// expand paths/globs into regular files
+static vector<string> expand_patterns(const vector<string> &patterns) {
+    vector<string> files;
+    for (const auto &p : patterns) {
+        glob_t g{};
+        if (glob(expand_path(p).c_str(), GLOB_TILDE, nullptr, &g) == 0) {
+            for (size_t i = 0; i < g.gl_pathc; ++i) {
+                if (fs::is_regular_file(g.gl_pathv[i])) files.push_back(g.gl_pathv[i]);
+            }
+        } else {
+            cerr << "No match: " << p << "\n";
+        }
+        globfree(&g);
+    }
+    sort(files.begin(), files.end());
+    files.erase(unique(files.begin(), files.end()), files.end());
+    return files;
+}
+
+void do_MPUT(int sock, const SessionInfo &info, int sessions, const vector<string> &patterns) {
+    vector<string> paths = expand_patterns(patterns);
+    if (paths.empty()) { cerr << "No files to upload\n"; return; }
+
+    // the pool uploads into the directory the interactive session is in
+    string remoteDir = "/";
+    if (send_line(sock, "PWD") && recv_line(sock).rfind("OK", 0) == 0) remoteDir = recv_line(sock);
+
+    // queued largest first: each free connection takes the next biggest file,
+    // which keeps the pool balanced (longest-processing-time scheduling)
+    struct Job { string path; uint64_t size; };
+    vector<Job> jobs;
+    uint64_t totalBytes = 0;
+    for (const auto &p : paths) {
+        jobs.push_back({p, (uint64_t)fs::file_size(p)});
+        totalBytes += jobs.back().size;
+    }
+    sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) { return a.size > b.size; });
+
+    sessions = max(1, min(sessions, (int)jobs.size()));
+    FtpClientOptions opts;
+    opts.host = info.serverIp;
+    opts.port = info.port;
+    opts.username = info.username;
+    opts.password = info.password;
+    opts.remoteDir = remoteDir;
+    opts.connections = sessions;
+    opts.maxRetries = 2;
+
+    uint64_t doneBytes = 0;
+    size_t doneFiles = 0;
+    vector<string> failed;
+    mutex outMutex;
+    auto start = chrono::steady_clock::now();
+    {
+        FtpClient pool(opts);
+        for (const auto &job : jobs) {
+            string remoteName = fs::path(job.path).filename().string();
+            pool.putFile(job.path, remoteName, [&, job, remoteName](const FtpResult &r) {
+                lock_guard<mutex> lock(outMutex);
+                if (r.ok) {
+                    doneBytes += job.size;
+                    ++doneFiles;
+                    cout << "[" << doneFiles << "/" << jobs.size() << "] " << remoteName << " (" << job.size << " bytes, "
+                         << (doneBytes * 100 / max<uint64_t>(1, totalBytes)) << "%";
+                    if (r.attempts > 1) cout << ", " << r.attempts << " attempts";
+                    cout << ")\n";
+                } else {
+                    failed.push_back(job.path);
+                    cout << "FAILED " << remoteName << ": " << r.error << "\n";
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Uploaded " << doneFiles << "/" << jobs.size() << " files, " << doneBytes << " bytes in " << secs
+         << " s over " << sessions << " sessions (" << (secs > 0 ? doneBytes / secs / (1024 * 1024) : 0) << " MB/s)\n";
+    for (const auto &f : failed) cout << "  failed: " << f << "\n";
+}
+
+// send one PUTPACK message; the server answers with a per-file status list
+static bool send_pack(int sock, const vector<pair<string, string>> &files, uint64_t &stored) {
+    string body;
+    for (const auto &f : files) {
+        body += to_string((unsigned long long)f.second.size()) + " " + f.first + "\n";
+        body += f.second;
+    }
+    if (!send_line(sock, "PUTPACK " + to_string(files.size()) + " " + to_string((unsigned long long)body.size()))) {
+        cerr << "Send failed\n";
+        return false;
+    }
+    string ready = recv_line(sock);
+    if (ready.rfind("READY", 0) != 0) {
+        cerr << "Server error: " << ready << "\n";
+        return false;
+    }
+    if (!send_all(sock, body.data(), body.size())) { cerr << "Send failed\n"; return false; }
+
+    string report, status;
+    if (!recv_text_block(sock, report, status)) {
+        cerr << "Server error: " << status << "\n";
+        return false;
+    }
+    istringstream lines(report);
+    string line;
+    while (getline(lines, line)) {
+        if (line.size() > 3 && line.compare(line.size() - 3, 3, " OK") == 0) ++stored;
+        else cout << line << "\n";
+    }
+    return true;
+}
+
+void do_PUTPACK(int sock, const vector<string> &patterns) {
+    vector<string> paths = expand_patterns(patterns);
+    if (paths.empty()) { cerr << "No files to upload\n"; return; }
+
+    vector<pair<string, string>> pack;
+    uint64_t packBytes = 0, stored = 0, packs = 0, total = 0;
+    for (const auto &p : paths) {
+        uint64_t fsize = fs::file_size(p);
+        string name = fs::path(p).filename().string();
+        if (fsize > PACK_MAX_FILE_BYTES) {
+            // not worth packing, upload it on its own
+            string err;
+            bool connLost = false;
+            ++total;
+            if (put_file(sock, p, name, err, connLost)) ++stored;
+            else cerr << name << ": " << err << "\n";
+            if (connLost) return;
+            continue;
+        }
+        uint64_t entryBytes = fsize + name.size() + 24;
+        if (!pack.empty() && packBytes + entryBytes > PACK_MAX_BYTES) {
+            if (!send_pack(sock, pack, stored)) return;
+            ++packs;
+            pack.clear();
+            packBytes = 0;
+        }
+        ifstream in(p, ios::binary);
+        string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        pack.emplace_back(name, move(data));
+        packBytes += entryBytes;
+        ++total;
+    }
+    if (!pack.empty()) {
+        if (!send_pack(sock, pack, stored)) return;
+        ++packs;
+    }
+    cout << "Uploaded " << stored << "/" << total << " files in " << packs << " packs\n";
+}
+
+void do_GETPACK(int sock, const vector<string> &names) {
+    string line = "GETPACK";
+    for (const auto &n : names) line += " " + n;
+    if (!send_line(sock, line)) { cerr << "Send failed\n"; return; }
+
+    string body, status;
+    if (!recv_text_block(sock, body, status)) {
+        cout << status << "\n";
+        return;
+    }
+
+    // entries: "OK <size> <name>\n<data>" or "ERROR 0 <name>\n"
+    size_t pos = 0, saved = 0;
+    while (pos < body.size()) {
+        size_t nl = body.find('\n', pos);
+        if (nl == string::npos) break;
+        istringstream hdr(body.substr(pos, nl - pos));
+        string st, name;
+        uint64_t fsize = 0;
+        hdr >> st >> fsize;
+        getline(hdr >> ws, name);
+        pos = nl + 1;
+        if (fsize > body.size() - pos) break;
+        string localName = fs::path(name).filename().string();
+        if (st == "OK" && !localName.empty()) {
+            ofstream out(localName, ios::binary);
+            out.write(body.data() + pos, fsize);
+            if (out) ++saved;
+            else cerr << "Cannot create local file " << localName << "\n";
+        } else {
+            cout << "ERROR: " << name << " not found or too large\n";
+        }
+        pos += fsize;
+    }
+    cout << "Downloaded " << saved << "/" << names.size() << " files\n";
 }
\ No newline at end of file
@@ -0,0 +1,659 @@
+#include "ftp_client_lib.h"
+#include "ftp_proto.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+#define LIB_BUFFER_SIZE (64 * 1024)
+#define SMALL_FRAME_BYTES 4096
+
+FileSource::FileSource(const string &path) : in(path, ios::binary) {
+    error_code ec;
+    fsize = fs::file_size(path, ec);
+    if (ec) in.close();
+}
+
+size_t FileSource::read(char *buf, size_t n) {
+    in.read(buf, n);
+    return (size_t)in.gcount();
+}
+
+bool FileSource::rewind() {
+    in.clear();
+    in.seekg(0);
+    return (bool)in;
+}
+
+size_t StringSource::read(char *buf, size_t n) {
+    size_t take = min(n, data.size() - pos);
+    memcpy(buf, data.data() + pos, take);
+    pos += take;
+    return take;
+}
+
+bool FileSink::begin(uint64_t size) {
+    (void)size;
+    out.open(path, ios::binary | ios::trunc);
+    return out.is_open();
+}
+
+bool FileSink::write(const char *data, size_t n) {
+    out.write(data, n);
+    return (bool)out;
+}
+
+bool FileSink::finish() {
+    out.close();
+    return !out.fail();
+}
+
+FtpClient::FtpClient(const FtpClientOptions &o) : opts(o) {
+    int n = max(1, opts.connections);
+    for (int i = 0; i < n; ++i) workers.emplace_back(&FtpClient::workerLoop, this);
+}
+
+FtpClient::~FtpClient() {
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto &t : workers) t.join();
+}
+
+future<FtpResult> FtpClient::submit(Op op) {
+    op.done = make_shared<promise<FtpResult>>();
+    future<FtpResult> f = op.done->get_future();
+    {
+        lock_guard<mutex> lock(mtx);
+        queue.push_back(move(op));
+    }
+    cv.notify_one();
+    return f;
+}
+
+future<FtpResult> FtpClient::put(const string &remoteName, shared_ptr<DataSource> src) {
+    return submit(Op{OpKind::Put, remoteName, move(src), nullptr, nullptr, nullptr});
+}
+
+future<FtpResult> FtpClient::get(const string &remoteName, shared_ptr<DataSink> sink) {
+    return submit(Op{OpKind::Get, remoteName, nullptr, move(sink), nullptr, nullptr});
+}
+
+future<FtpResult> FtpClient::getAll(const string &userPath, shared_ptr<DataSink> sink) {
+    return submit(Op{OpKind::GetAll, userPath, nullptr, move(sink), nullptr, nullptr});
+}
+
+future<FtpResult> FtpClient::list() { return submit(Op{OpKind::List, "", nullptr, nullptr, nullptr, nullptr}); }
+
+future<FtpResult> FtpClient::listAll() { return submit(Op{OpKind::ListAll, "", nullptr, nullptr, nullptr, nullptr}); }
+
+future<FtpResult> FtpClient::mkdir(const string &dirname) {
+    return submit(Op{OpKind::Mkdir, dirname, nullptr, nullptr, nullptr, nullptr});
+}
+
+future<FtpResult> FtpClient::remove(const string &filename) {
+    return submit(Op{OpKind::Delete, filename, nullptr, nullptr, nullptr, nullptr});
+}
+
+future<FtpResult> FtpClient::copy(const string &source, const string &target) {
+    return submit(Op{OpKind::Copy, source + " " + target, nullptr, nullptr, nullptr, nullptr});
+}
+
+future<FtpResult> FtpClient::rename(const string &source, const string &target) {
+    return submit(Op{OpKind::Move, source + " " + target, nullptr, nullptr, nullptr, nullptr});
+}
+
+void FtpClient::put(const string &remoteName, shared_ptr<DataSource> src, Callback cb) {
+    submit(Op{OpKind::Put, remoteName, move(src), nullptr, move(cb), nullptr});
+}
+
+void FtpClient::get(const string &remoteName, shared_ptr<DataSink> sink, Callback cb) {
+    submit(Op{OpKind::Get, remoteName, nullptr, move(sink), move(cb), nullptr});
+}
+
+static string defaultRemoteName(const string &localPath, const string &remoteName) {
+    return remoteName.empty() ? fs::path(localPath).filename().string() : remoteName;
+}
+
+// helper: the result of a putFile whose local file cannot be read
+static FtpResult openFailed(const string &localPath) {
+    FtpResult res;
+    res.error = "Cannot open file " + localPath;
+    return res;
+}
+
+future<FtpResult> FtpClient::putFile(const string &localPath, const string &remoteName) {
+    auto src = make_shared<FileSource>(localPath);
+    if (!src->ok()) {
+        promise<FtpResult> failed;
+        failed.set_value(openFailed(localPath));
+        return failed.get_future();
+    }
+    return put(defaultRemoteName(localPath, remoteName), src);
+}
+
+void FtpClient::putFile(const string &localPath, const string &remoteName, Callback cb) {
+    auto src = make_shared<FileSource>(localPath);
+    if (!src->ok()) {
+        if (cb) cb(openFailed(localPath));
+        return;
+    }
+    put(defaultRemoteName(localPath, remoteName), src, move(cb));
+}
+
+future<FtpResult> FtpClient::getFile(const string &remoteName, const string &localPath) {
+    string local = localPath.empty() ? fs::path(remoteName).filename().string() : localPath;
+    return get(remoteName, make_shared<FileSink>(local));
+}
+
+size_t FtpClient::pending() {
+    lock_guard<mutex> lock(mtx);
+    return queue.size() + running;
+}
+
+void FtpClient::wait() {
+    unique_lock<mutex> lock(mtx);
+    idleCv.wait(lock, [this] { return queue.empty() && running == 0; });
+}
+
+bool FtpClient::writeAll(int fd, const char *data, size_t n) {
+    size_t sent = 0;
+    while (sent < n) {
+        ssize_t s = send(fd, data + sent, n - sent, MSG_NOSIGNAL);
+        if (s < 0 && errno == EINTR) continue;
+        if (s <= 0) return false;
+        sent += s;
+    }
+    return true;
+}
+
+// connections keep their read buffer between operations: the server never
+// sends unsolicited data, so nothing read ahead belongs to anyone else
+bool FtpClient::readLine(Conn &c, string &line) {
+    line.clear();
+    while (true) {
+        if (c.pos == c.len) {
+            ssize_t r = recv(c.fd, c.buf.data(), c.buf.size(), 0);
+            if (r <= 0) return false;
+            c.pos = 0;
+            c.len = (size_t)r;
+        }
+        const char *start = c.buf.data() + c.pos;
+        const char *nl = (const char *)memchr(start, '\n', c.len - c.pos);
+        if (nl) {
+            line.append(start, nl - start);
+            c.pos += (nl - start) + 1;
+            return true;
+        }
+        line.append(start, c.len - c.pos);
+        c.pos = c.len;
+    }
+}
+
+bool FtpClient::readBody(Conn &c, DataSink &sink, uint64_t n) {
+    bool sinkOk = true;
+    while (n > 0) {
+        if (c.pos == c.len) {
+            ssize_t r = recv(c.fd, c.buf.data(), c.buf.size(), 0);
+            if (r <= 0) return false;
+            c.pos = 0;
+            c.len = (size_t)r;
+        }
+        size_t take = (size_t)min<uint64_t>(n, c.len - c.pos);
+        // keep draining after a sink error so the connection stays usable
+        if (sinkOk) sinkOk = sink.write(c.buf.data() + c.pos, take);
+        c.pos += take;
+        n -= take;
+    }
+    return true;
+}
+
+bool FtpClient::readExact(Conn &c, char *dst, size_t n) {
+    while (n > 0) {
+        if (c.pos == c.len) {
+            ssize_t r = recv(c.fd, c.buf.data(), c.buf.size(), 0);
+            if (r <= 0) return false;
+            c.pos = 0;
+            c.len = (size_t)r;
+        }
+        size_t take = min(n, c.len - c.pos);
+        memcpy(dst, c.buf.data() + c.pos, take);
+        c.pos += take;
+        dst += take;
+        n -= take;
+    }
+    return true;
+}
+
+bool FtpClient::sendFrame(Conn &c, uint8_t opcode, uint16_t flags, uint32_t id, const char *data, size_t n) {
+    char hdr[FRAME_HEADER_SIZE];
+    FrameHeader h;
+    h.length = (uint32_t)n;
+    h.opcode = opcode;
+    h.flags = flags;
+    h.requestId = id;
+    encodeFrameHeader(hdr, h);
+    if (n <= SMALL_FRAME_BYTES) {
+        // one send per small frame; a separate tiny header write would sit in Nagle's queue
+        char one[FRAME_HEADER_SIZE + SMALL_FRAME_BYTES];
+        memcpy(one, hdr, sizeof(hdr));
+        if (n > 0) memcpy(one + sizeof(hdr), data, n);
+        return writeAll(c.fd, one, sizeof(hdr) + n);
+    }
+    return writeAll(c.fd, hdr, sizeof(hdr)) && writeAll(c.fd, data, n);
+}
+
+bool FtpClient::readFrame(Conn &c, uint8_t &opcode, uint16_t &flags, uint32_t &id, string &payload) {
+    char hdr[FRAME_HEADER_SIZE];
+    FrameHeader h;
+    if (!readExact(c, hdr, sizeof(hdr)) || !decodeFrameHeader(hdr, h)) return false;
+    payload.resize(h.length);
+    if (h.length > 0 && !readExact(c, &payload[0], h.length)) return false;
+    opcode = h.opcode;
+    flags = h.flags;
+    id = h.requestId;
+    return true;
+}
+
+// a frame (or part of one) is waiting to be read
+bool FtpClient::replyPending(Conn &c) {
+    if (c.pos < c.len) return true;
+    pollfd pfd{c.fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// one request with a single-frame reply; false = transport failure
+bool FtpClient::requestV2(Conn &c, uint8_t opcode, const string &args, string &reply, bool &isError) {
+    uint32_t id = c.nextId++;
+    if (!sendFrame(c, opcode, 0, id, args.data(), args.size())) return false;
+    uint8_t op;
+    uint16_t flags;
+    uint32_t rid;
+    do {
+        if (!readFrame(c, op, flags, rid, reply)) return false;
+    } while (rid != id); // a connection only has one request in flight, but be safe
+    isError = (flags & FRAME_ERROR) != 0;
+    return true;
+}
+
+bool FtpClient::openConn(Conn &c, string &err) {
+    c.fd = socket(AF_INET, SOCK_STREAM, 0);
+    c.buf.resize(LIB_BUFFER_SIZE);
+    c.pos = c.len = 0;
+    sockaddr_in srv{};
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(opts.port);
+    if (c.fd < 0 || inet_pton(AF_INET, opts.host.c_str(), &srv.sin_addr) != 1 ||
+        connect(c.fd, (sockaddr *)&srv, sizeof(srv)) < 0) {
+        err = "Connect failed";
+        closeConn(c);
+        return false;
+    }
+
+    c.v2 = false;
+    c.nextId = 1;
+    if (opts.protocol >= 2) {
+        string hello = string(PROTO_HELLO) + "\n", answer;
+        if (!writeAll(c.fd, hello.data(), hello.size()) || !readLine(c, answer)) {
+            err = "Connection lost";
+            closeConn(c);
+            return false;
+        }
+        c.v2 = answer == PROTO_HELLO; // older servers answer ERROR and stay on text
+    }
+    if (c.v2) {
+        // frames are written whole, and a PUT's data must not wait for the ACK of its request
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (c.v2) {
+        string reply;
+        bool isError = false;
+        string dir = opts.remoteDir;
+        while (!dir.empty() && dir[0] == '/') dir.erase(0, 1);
+        if (!requestV2(c, OP_LOGIN, opts.username + " " + opts.password, reply, isError) || isError ||
+            (!dir.empty() && (!requestV2(c, OP_CD, dir, reply, isError) || isError))) {
+            err = reply.empty() ? "Login failed" : reply;
+            closeConn(c);
+            return false;
+        }
+        return true;
+    }
+
+    string line = "LOGIN " + opts.username + " " + opts.password + "\n";
+    string reply;
+    if (!writeAll(c.fd, line.data(), line.size()) || !readLine(c, reply) || reply != "LOGGED IN") {
+        err = reply.empty() ? "Login failed" : reply;
+        closeConn(c);
+        return false;
+    }
+
+    string dir = opts.remoteDir;
+    while (!dir.empty() && dir[0] == '/') dir.erase(0, 1);
+    if (!dir.empty()) {
+        line = "CD " + dir + "\n";
+        if (!writeAll(c.fd, line.data(), line.size()) || !readLine(c, reply) || reply != "OK") {
+            err = reply.empty() ? "CD failed" : reply;
+            closeConn(c);
+            return false;
+        }
+        readLine(c, reply); // "Directory changed"
+    }
+    return true;
+}
+
+void FtpClient::closeConn(Conn &c) {
+    if (c.fd >= 0) close(c.fd);
+    c.fd = -1;
+    c.pos = c.len = 0;
+}
+
+// v2: same operations as attempt(), framed
+FtpResult FtpClient::attemptV2(Conn &c, Op &op, bool &connLost) {
+    FtpResult res;
+    connLost = false;
+    auto lost = [&](const string &what) {
+        connLost = true;
+        res.error = what;
+        return res;
+    };
+    string reply;
+    bool isError = false;
+
+    switch (op.kind) {
+    case OpKind::Put: {
+        if (!op.src) {
+            res.error = "No data source";
+            return res;
+        }
+        uint64_t fsize = op.src->size();
+        uint32_t id = c.nextId++;
+        string args = to_string((unsigned long long)fsize) + " " + op.arg;
+        uint8_t opcode;
+        uint16_t flags;
+        uint32_t rid;
+        if (!sendFrame(c, OP_PUT, 0, id, args.data(), args.size())) return lost("Send failed");
+        // READY or the rejection (quota, name, disk) before any data goes out
+        do {
+            if (!readFrame(c, opcode, flags, rid, reply)) return lost("Connection lost");
+        } while (rid != id);
+        if (flags & FRAME_ERROR) {
+            res.error = "ERROR: " + reply;
+            return res;
+        }
+        vector<char> buf(FRAME_DATA_CHUNK);
+        uint64_t left = fsize;
+        do {
+            if (replyPending(c)) {
+                // the server failed the upload mid-stream: stop sending and let it drop the rest
+                if (!readFrame(c, opcode, flags, rid, reply)) return lost("Connection lost");
+                if (rid == id && (flags & FRAME_ERROR)) {
+                    static const char why[] = "server error";
+                    if (!sendFrame(c, OP_DATA, FRAME_END | FRAME_ERROR, id, why, sizeof(why) - 1)) return lost("Send failed");
+                    res.error = "ERROR: " + reply;
+                    return res;
+                }
+            }
+            size_t want = (size_t)min<uint64_t>(buf.size(), left);
+            size_t n = want ? op.src->read(buf.data(), want) : 0;
+            if (n == 0 && want) {
+                // the source shrank: make the server drop the upload instead of storing a short file
+                static const char why[] = "source ended early";
+                if (!sendFrame(c, OP_DATA, FRAME_END | FRAME_ERROR, id, why, sizeof(why) - 1)) return lost("Send failed");
+                do {
+                    if (!readFrame(c, opcode, flags, rid, reply)) return lost("Connection lost");
+                } while (rid != id);
+                res.error = "Local data ended early";
+                return res;
+            }
+            left -= n;
+            if (!sendFrame(c, OP_DATA, left == 0 ? FRAME_END : 0, id, buf.data(), n)) return lost("Send failed");
+        } while (left > 0);
+        do {
+            if (!readFrame(c, opcode, flags, rid, reply)) return lost("Connection lost");
+        } while (rid != id);
+        if (flags & FRAME_ERROR) {
+            res.error = "ERROR: " + reply;
+            return res;
+        }
+        res.ok = true;
+        res.bytes = fsize;
+        return res;
+    }
+    case OpKind::Get:
+    case OpKind::GetAll: {
+        uint32_t id = c.nextId++;
+        uint8_t opcode = op.kind == OpKind::Get ? OP_GET : OP_GETALL;
+        uint16_t flags;
+        uint32_t rid;
+        if (!op.sink) {
+            res.error = "No data sink";
+            return res;
+        }
+        if (!sendFrame(c, opcode, 0, id, op.arg.data(), op.arg.size())) return lost("Send failed");
+        if (!readFrame(c, opcode, flags, rid, reply)) return lost("Connection lost");
+        if (flags & FRAME_ERROR) {
+            res.error = "ERROR: " + reply;
+            return res;
+        }
+        uint64_t size = 0;
+        try {
+            size = stoull(reply);
+        } catch (...) {
+            return lost("Bad size");
+        }
+        bool sinkOk = op.sink->begin(size);
+        uint64_t got = 0;
+        string data;
+        do {
+            if (!readFrame(c, opcode, flags, rid, data)) return lost("Receive failed");
+            if (sinkOk && !data.empty()) sinkOk = op.sink->write(data.data(), data.size());
+            got += data.size();
+        } while (!(flags & FRAME_END));
+        sinkOk = op.sink->finish() && sinkOk;
+        if (got != size) return lost("Size mismatch");
+        if (!sinkOk) {
+            res.error = "Cannot write local data";
+            return res;
+        }
+        res.ok = true;
+        res.bytes = size;
+        return res;
+    }
+    case OpKind::List:
+    case OpKind::ListAll:
+    case OpKind::Mkdir:
+    case OpKind::Delete:
+    case OpKind::Copy:
+    case OpKind::Move: {
+        uint8_t opcode = op.kind == OpKind::List      ? OP_LIST
+                         : op.kind == OpKind::ListAll ? OP_LISTALL
+                         : op.kind == OpKind::Mkdir   ? OP_MKDIR
+                         : op.kind == OpKind::Delete  ? OP_DELETE
+                         : op.kind == OpKind::Copy    ? OP_COPY
+                                                      : OP_MOVE;
+        if (!requestV2(c, opcode, op.arg, reply, isError)) return lost("Connection lost");
+        if (isError) {
+            res.error = "ERROR: " + reply;
+            return res;
+        }
+        res.ok = true;
+        res.text = move(reply);
+        res.bytes = res.text.size();
+        return res;
+    }
+    }
+    res.error = "Unknown operation";
+    return res;
+}
+
+// one try of op on an open connection; connLost = the failure was the transport's
+FtpResult FtpClient::attempt(Conn &c, Op &op, bool &connLost) {
+    if (c.v2) return attemptV2(c, op, connLost);
+    FtpResult res;
+    connLost = false;
+    string reply;
+    auto lost = [&](const string &what) {
+        connLost = true;
+        res.error = what;
+        return res;
+    };
+    auto serverError = [&](const string &line) {
+        res.error = line;
+        return res;
+    };
+
+    switch (op.kind) {
+    case OpKind::Put: {
+        if (!op.src) return serverError("No data source");
+        uint64_t fsize = op.src->size();
+        string cmd = "PUT " + op.arg + "\n";
+        if (!writeAll(c.fd, cmd.data(), cmd.size()) || !readLine(c, reply)) return lost("Connection lost");
+        if (reply != "READY") return serverError(reply);
+        cmd = "SIZE " + to_string((unsigned long long)fsize) + "\n";
+        if (!writeAll(c.fd, cmd.data(), cmd.size()) || !readLine(c, reply)) return lost("Connection lost");
+        if (reply != "OK") return serverError(reply);
+
+        vector<char> buf(LIB_BUFFER_SIZE);
+        uint64_t left = fsize;
+        while (left > 0) {
+            size_t want = (size_t)min<uint64_t>(buf.size(), left);
+            size_t n = op.src->read(buf.data(), want);
+            if (n == 0) {
+                // the source shrank: hang up so the server drops the temp file.
+                // Not a connection failure, a retry would come up short again.
+                closeConn(c);
+                return serverError("Local data ended early");
+            }
+            if (!writeAll(c.fd, buf.data(), n)) return lost("Send failed");
+            left -= n;
+        }
+        if (!readLine(c, reply)) return lost("Connection lost");
+        if (reply != "OK") return serverError(reply);
+        res.ok = true;
+        res.bytes = fsize;
+        return res;
+    }
+    case OpKind::Get:
+    case OpKind::GetAll:
+    case OpKind::List:
+    case OpKind::ListAll: {
+        string cmd = op.kind == OpKind::Get      ? "GET " + op.arg
+                     : op.kind == OpKind::GetAll ? "GETALL " + op.arg
+                     : op.kind == OpKind::List   ? string("LIST")
+                                                 : string("LISTALL");
+        cmd += "\n";
+        if (!writeAll(c.fd, cmd.data(), cmd.size()) || !readLine(c, reply)) return lost("Connection lost");
+        if (reply != "OK") return serverError(reply);
+        string sizeLine;
+        if (!readLine(c, sizeLine)) return lost("Connection lost");
+        uint64_t size = 0;
+        try {
+            size = stoull(sizeLine);
+        } catch (...) {
+            return lost("Bad size");
+        }
+
+        StringSink text;
+        DataSink &sink = op.sink ? *op.sink : text;
+        bool sinkOk = sink.begin(size);
+        if (!readBody(c, sink, size)) return lost("Receive failed");
+        sinkOk = sink.finish() && sinkOk;
+        if (!sinkOk) return serverError("Cannot write local data");
+        res.ok = true;
+        res.bytes = size;
+        if (!op.sink) res.text = move(text.data);
+        return res;
+    }
+    case OpKind::Mkdir:
+    case OpKind::Delete:
+    case OpKind::Copy:
+    case OpKind::Move: {
+        const char *verb = op.kind == OpKind::Mkdir    ? "MKDIR "
+                           : op.kind == OpKind::Delete ? "DELETE "
+                           : op.kind == OpKind::Copy   ? "COPY "
+                                                       : "MOVE ";
+        string cmd = verb + op.arg + "\n";
+        if (!writeAll(c.fd, cmd.data(), cmd.size()) || !readLine(c, reply)) return lost("Connection lost");
+        if (reply != "OK") return serverError(reply);
+        if (!readLine(c, res.text)) return lost("Connection lost");
+        res.ok = true;
+        return res;
+    }
+    }
+    return serverError("Unknown operation");
+}
+
+// helper: safe to send again after the connection dropped mid-request. A PUT
+// lands through a temp file and a rename, GET/LIST only read; the other verbs
+// change the tree and may have been applied before the reply was lost.
+bool FtpClient::retryAfterLoss(OpKind kind) {
+    switch (kind) {
+    case OpKind::Put:
+    case OpKind::Get:
+    case OpKind::GetAll:
+    case OpKind::List:
+    case OpKind::ListAll:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void FtpClient::workerLoop() {
+    Conn conn;
+    while (true) {
+        Op op;
+        {
+            unique_lock<mutex> lock(mtx);
+            cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) break; // stopping and drained
+            op = move(queue.front());
+            queue.pop_front();
+            ++running;
+        }
+
+        FtpResult res;
+        int delay = opts.retryDelayMs;
+        for (int i = 0; i <= opts.maxRetries; ++i) {
+            if (i > 0) {
+                // rewind before retrying; a stream that cannot rewind is not retried
+                if ((op.src && !op.src->rewind()) || (op.sink && !op.sink->reset())) break;
+                this_thread::sleep_for(chrono::milliseconds(delay));
+                delay *= 2;
+            }
+            res.attempts = i + 1;
+            if (conn.fd < 0 && !openConn(conn, res.error)) continue;
+            bool connLost = false;
+            int attempts = res.attempts;
+            res = attempt(conn, op, connLost);
+            res.attempts = attempts;
+            if (!connLost) break;
+            closeConn(conn);
+            if (!retryAfterLoss(op.kind)) break;
+        }
+
+        if (op.cb) op.cb(res);
+        op.done->set_value(move(res));
+        {
+            lock_guard<mutex> lock(mtx);
+            --running;
+            if (queue.empty() && running == 0) idleCv.notify_all();
+        }
+    }
+
+    if (conn.fd >= 0) {
+        if (!conn.v2) writeAll(conn.fd, "EXIT\n", 5);
+        closeConn(conn);
+    }
+}
\ No newline at end of file
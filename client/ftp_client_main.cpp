@@ -17,20 +17,15 @@ int main(int argc, char *argv[]) {
     string serverIp = argv[1];
     int port = stoi(argv[2]);
 
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) { cerr << "Socket failed\n"; return 1; }
-
-    sockaddr_in srv{};
-    srv.sin_family = AF_INET;
-    srv.sin_port = htons(port);
-    inet_pton(AF_INET, serverIp.c_str(), &srv.sin_addr);
-
-    if (connect(sock, (sockaddr *)&srv, sizeof(srv)) < 0) {
-        cerr << "Connect failed\n"; close(sock); return 1;
-    }
+    int sock = connect_to_server(serverIp, port);
+    if (sock < 0) { cerr << "Connect failed\n"; return 1; }
 
     cout << "Connected to FTP server.\n";
 
+    SessionInfo session;
+    session.serverIp = serverIp;
+    session.port = port;
+
     string line;
     while (true) {
         cout << "ftp> ";
@@ -50,28 +45,72 @@ int main(int argc, char *argv[]) {
             string f; iss >> f;
             if (f.empty()) { cerr << "Usage: GET <filename>\n"; continue; }
             do_GET_common(sock, "GET", f);
+        } else if (cmd == "PUTSPARSE") {
+            string f; iss >> f;
+            if (f.empty()) { cerr << "Usage: PUTSPARSE <local_path>\n"; continue; }
+            do_PUTSPARSE(sock, f);
+        } else if (cmd == "GETSPARSE") {
+            string f; iss >> f;
+            if (f.empty()) { cerr << "Usage: GETSPARSE <filename>\n"; continue; }
+            do_GETSPARSE(sock, f);
         } else if (cmd == "GETALL") {
             string f; iss >> f;
             if (f.empty()) { cerr << "Usage: GETALL <username/filename>\n"; continue; }
             do_GET_common(sock, "GETALL", f);
-        } else if (cmd == "LIST" || cmd == "LISTALL" || cmd == "HELP") {
+        } else if (cmd == "MPUT") {
+            // MPUT [-n <sessions>] <path|glob> ...
+            int sessions = 4;
+            vector<string> patterns;
+            string arg;
+            while (iss >> arg) {
+                if (arg == "-n" && iss >> arg) {
+                    try { sessions = stoi(arg); } catch (...) { sessions = 0; }
+                } else {
+                    patterns.push_back(arg);
+                }
+            }
+            if (patterns.empty() || sessions < 1) { cerr << "Usage: MPUT [-n <sessions>] <path|glob> ...\n"; continue; }
+            if (session.username.empty()) { cerr << "LOGIN first\n"; continue; }
+            do_MPUT(sock, session, sessions, patterns);
+        } else if (cmd == "PUTPACK" || cmd == "GETPACK") {
+            vector<string> args;
+            string a;
+            while (iss >> a) args.push_back(a);
+            if (args.empty()) { cerr << "Usage: " << cmd << " <file> ...\n"; continue; }
+            if (cmd == "PUTPACK") do_PUTPACK(sock, args);
+            else do_GETPACK(sock, args);
+        } else if (cmd == "PUTDIR") {
+            string d; iss >> d;
+            if (d.empty()) { cerr << "Usage: PUTDIR <local_dir>\n"; continue; }
+            do_PUTDIR(sock, d);
+        } else if (cmd == "GETDIR") {
+            string d; iss >> d;
+            if (d.empty()) { cerr << "Usage: GETDIR <dirname>\n"; continue; }
+            do_GETDIR(sock, d);
+        } else if (cmd == "FIND" || cmd == "LIST" || cmd == "LISTALL") {
+            // options travel with the command
+            do_LIST_like(sock, line);
+        } else if (cmd == "WATCH") {
+            do_WATCH(sock, line);
+        } else if (cmd == "HELP" || cmd == "STATS" || cmd == "USAGE") {
             do_LIST_like(sock, cmd);
-        } else if (cmd == "PWD" || cmd == "DELETE" || cmd == "MKDIR" || cmd == "CD") {
+        } else if (cmd == "PWD" || cmd == "DELETE" || cmd == "MKDIR" || cmd == "CD" || cmd == "COPY" || cmd == "MOVE") {
+            // reply is "OK\n<message>\n" or a single "ERROR: ...\n" line
             send_line(sock, line);
-            string resp;
-            char buf[1024];
-            ssize_t r = recv(sock, buf, sizeof(buf)-1, 0);
-            if (r > 0) {
-                buf[r] = 0;
-                resp = buf;
-            }
-            if (resp.empty()) cout << "No response from server\n"; else cout << resp;
+            string resp = recv_line(sock);
+            if (resp.empty()) { cout << "No response from server\n"; continue; }
+            cout << resp << "\n";
+            if (resp == "OK") cout << recv_line(sock) << "\n";
         } else if (cmd == "REGISTER" || cmd == "LOGIN") {
             // send as-is and print single-line response or size-prefixed response
             send_line(sock, line);
             // server previously replies with either "REGISTERED\n" or error or "LOGGED IN\n"
             string resp = recv_line(sock);
             if (resp.empty()) cout << "No response\n"; else cout << resp << "\n";
+            if (cmd == "LOGIN" && resp == "LOGGED IN") {
+                // remembered for the extra sessions MPUT opens
+                iss >> session.username >> session.password;
+            }
         } else {
             // unknown: send raw and print response
             send_line(sock, line);
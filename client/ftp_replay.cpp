@@ -0,0 +1,620 @@
+// ftp_replay: plays a session recording (ftp_server --record) against a server
+// and reports per-command latency and throughput. Run it once per build with
+// --report, then against the next build with --compare to see the difference.
+#include "ftp_client.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = chrono::steady_clock;
+
+// one recorded command, times relative to the start of the recording
+struct RecordedOp {
+    int64_t at = 0;
+    int64_t dur = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    string verb;
+    string args;
+};
+
+struct RecordedSession {
+    vector<RecordedOp> ops;
+};
+
+struct ReplayOptions {
+    string host = "127.0.0.1";
+    int port = 2121;
+    double speed = 1.0;  // 0 = no think time at all
+    int scale = 1;       // copies of every recorded session
+    string password = "replay";
+    string prefix = "rp_";
+    bool setup = true;
+    string reportFile;
+    string compareFile;
+};
+
+struct VerbStats {
+    vector<int64_t> latencies; // microseconds
+    uint64_t errors = 0;
+    uint64_t bytes = 0;
+};
+
+static ReplayOptions opts;
+static mutex statsMutex;
+static map<string, VerbStats> results;
+static uint64_t skippedOps = 0;
+static uint64_t abortedOps = 0;
+
+static void printUsage() {
+    cout << "Usage: ./ftp_replay <recording> [options]\n"
+         << "  --host <ip>         server address (default 127.0.0.1)\n"
+         << "  --port <n>          server port (default 2121)\n"
+         << "  --speed <x>         1 = recorded pace, 10 = ten times faster, 0 = no pauses (default 1)\n"
+         << "  --scale <n>         run every recorded session n times at once, each copy as its own users (default 1)\n"
+         << "  --password <pw>     password of the replay users (default replay)\n"
+         << "  --prefix <s>        replay users are <prefix><recorded user>[_<copy>] (default rp_)\n"
+         << "  --no-setup          do not create the directories and files the recording reads\n"
+         << "  --report <file>     save the results for a later --compare\n"
+         << "  --compare <file>    show the change against a saved report (e.g. the previous build)\n"
+         << "PUT payloads are synthetic data of the recorded size; passwords are not recorded.\n";
+}
+
+static bool parseArgs(int argc, char *argv[], string &recording) {
+    if (argc < 2) return false;
+    recording = argv[1];
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        string val;
+        auto next = [&]() {
+            if (i + 1 >= argc) return false;
+            val = argv[++i];
+            return true;
+        };
+        try {
+            if (arg == "--host") {
+                if (!next()) return false;
+                opts.host = val;
+            } else if (arg == "--port") {
+                if (!next()) return false;
+                opts.port = stoi(val);
+            } else if (arg == "--speed") {
+                if (!next()) return false;
+                opts.speed = stod(val);
+                if (opts.speed < 0) return false;
+            } else if (arg == "--scale") {
+                if (!next()) return false;
+                opts.scale = stoi(val);
+                if (opts.scale < 1) return false;
+            } else if (arg == "--password") {
+                if (!next()) return false;
+                opts.password = val;
+            } else if (arg == "--prefix") {
+                if (!next()) return false;
+                opts.prefix = val;
+            } else if (arg == "--no-setup") {
+                opts.setup = false;
+            } else if (arg == "--report") {
+                if (!next()) return false;
+                opts.reportFile = val;
+            } else if (arg == "--compare") {
+                if (!next()) return false;
+                opts.compareFile = val;
+            } else {
+                return false;
+            }
+        } catch (...) {
+            cerr << "Bad value for " << arg << ": " << val << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// <session> <start_us> <dur_us> <bytes_in> <bytes_out> <VERB>[ <args>]
+static bool loadRecording(const string &path, vector<RecordedSession> &sessions) {
+    ifstream in(path);
+    if (!in.is_open()) return false;
+    map<string, size_t> bySession;
+    int64_t origin = -1;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream iss(line);
+        string sid;
+        long long start = 0, dur = 0;
+        unsigned long long bin = 0, bout = 0;
+        RecordedOp op;
+        if (!(iss >> sid >> start >> dur >> bin >> bout >> op.verb)) continue;
+        getline(iss, op.args);
+        if (!op.args.empty() && op.args[0] == ' ') op.args.erase(0, 1);
+        op.at = start;
+        op.dur = dur;
+        op.bytesIn = bin;
+        op.bytesOut = bout;
+        if (origin < 0 || start < origin) origin = start;
+        auto it = bySession.find(sid);
+        if (it == bySession.end()) {
+            it = bySession.emplace(sid, sessions.size()).first;
+            sessions.emplace_back();
+        }
+        sessions[it->second].ops.push_back(op);
+    }
+    for (auto &s : sessions) {
+        for (auto &op : s.ops) op.at -= origin;
+        // lines are written when commands finish; replay them in the order they started
+        stable_sort(s.ops.begin(), s.ops.end(), [](const RecordedOp &a, const RecordedOp &b) { return a.at < b.at; });
+    }
+    return true;
+}
+
+static string replayUser(const string &recorded, int copy) {
+    return opts.prefix + recorded + (opts.scale > 1 ? "_" + to_string(copy) : "");
+}
+
+// helper: "cwd/name" relative to the home, "" for the home itself; false if it leaves the home
+static bool joinRelative(const string &cwd, const string &name, string &out) {
+    fs::path p = (fs::path(cwd) / name).lexically_normal();
+    string s = p.string();
+    while (!s.empty() && s.back() == '/') s.pop_back();
+    if (s == ".") s.clear();
+    if (s.rfind("..", 0) == 0 || (!s.empty() && s[0] == '/')) return false;
+    out = s;
+    return true;
+}
+
+// what must exist in a user's home before the replay starts
+struct HomeSetup {
+    set<string> dirs;
+    map<string, uint64_t> files; // path -> size
+    set<string> made;            // created by the recording itself
+};
+
+// follow every session's working directory through the recording and collect
+// the directories it enters and the files it reads without creating them first
+static map<string, HomeSetup> planSetup(const vector<RecordedSession> &sessions) {
+    struct Cursor {
+        size_t session, op;
+        int64_t at;
+    };
+    vector<Cursor> order;
+    for (size_t i = 0; i < sessions.size(); ++i) {
+        for (size_t j = 0; j < sessions[i].ops.size(); ++j) order.push_back({i, j, sessions[i].ops[j].at});
+    }
+    stable_sort(order.begin(), order.end(), [](const Cursor &a, const Cursor &b) { return a.at < b.at; });
+
+    map<string, HomeSetup> homes;
+    vector<string> user(sessions.size()), cwd(sessions.size());
+    for (const auto &c : order) {
+        const RecordedOp &op = sessions[c.session].ops[c.op];
+        string &u = user[c.session];
+        string &dir = cwd[c.session];
+        string arg = op.args.substr(0, op.args.find(' '));
+        string path;
+        if (op.verb == "LOGIN") {
+            u = arg;
+            dir.clear();
+            continue;
+        }
+        if (u.empty()) continue;
+        HomeSetup &home = homes[u];
+        if (op.verb == "CD") {
+            if (!joinRelative(dir, arg, path)) continue;
+            if (!path.empty() && !home.made.count(path)) home.dirs.insert(path);
+            dir = path;
+        } else if (op.verb == "MKDIR") {
+            if (joinRelative(dir, arg, path)) home.made.insert(path);
+        } else if (op.verb == "PUT") {
+            if (joinRelative(dir, fs::path(arg).filename().string(), path)) home.made.insert(path);
+        } else if (op.verb == "GET") {
+            if (op.bytesOut > 0 && joinRelative(dir, fs::path(arg).filename().string(), path) && !home.made.count(path)) {
+                home.files[path] = max(home.files[path], op.bytesOut);
+            }
+        } else if (op.verb == "DELETE") {
+            if (joinRelative(dir, arg, path) && !home.made.count(path) && !home.files.count(path)) home.files[path] = 0;
+        } else if (op.verb == "GETALL") {
+            size_t slash = arg.find('/');
+            if (slash == string::npos || op.bytesOut == 0) continue;
+            HomeSetup &owner = homes[arg.substr(0, slash)];
+            if (joinRelative("", arg.substr(slash + 1), path) && !path.empty() && !owner.made.count(path)) {
+                owner.files[path] = max(owner.files[path], op.bytesOut);
+            }
+        }
+    }
+    // parents of everything, so MKDIR can go one level at a time
+    for (auto &kv : homes) {
+        set<string> all;
+        auto addParents = [&all](const string &p) {
+            for (fs::path d = fs::path(p); !d.empty(); d = d.parent_path()) all.insert(d.string());
+        };
+        for (const auto &d : kv.second.dirs) addParents(d);
+        for (const auto &f : kv.second.files) addParents(fs::path(f.first).parent_path().string());
+        kv.second.dirs = all;
+    }
+    return homes;
+}
+
+// helper: PUT n bytes of filler under name in the current directory
+static bool putSynthetic(int sock, const string &name, uint64_t n) {
+    static const vector<char> filler = [] {
+        vector<char> b(STREAM_BUFFER_SIZE);
+        for (size_t i = 0; i < b.size(); ++i) b[i] = (char)('a' + i % 26);
+        return b;
+    }();
+    if (!send_line(sock, "PUT " + name)) return false;
+    if (recv_line(sock).rfind("READY", 0) != 0) return false;
+    if (!send_line(sock, "SIZE " + to_string((unsigned long long)n))) return false;
+    if (recv_line(sock).rfind("OK", 0) != 0) return false;
+    uint64_t left = n;
+    while (left > 0) {
+        size_t chunk = (size_t)min<uint64_t>(filler.size(), left);
+        if (!send_all(sock, filler.data(), chunk)) return false;
+        left -= chunk;
+    }
+    return recv_line(sock).rfind("OK", 0) == 0;
+}
+
+// helper: read and discard n bytes
+static bool drainBytes(int sock, uint64_t n) {
+    char buf[STREAM_BUFFER_SIZE];
+    while (n > 0) {
+        ssize_t r = recv(sock, buf, (size_t)min<uint64_t>(sizeof(buf), n), 0);
+        if (r <= 0) return false;
+        n -= (uint64_t)r;
+    }
+    return true;
+}
+
+// "OK\n<size>\n<bytes>" or "ERROR: ..."; bytes counts what was received
+static bool readSizedReply(int sock, uint64_t &bytes, bool &connLost) {
+    string status = recv_line(sock);
+    if (status.empty()) {
+        connLost = true;
+        return false;
+    }
+    if (status.rfind("OK", 0) != 0) return false;
+    uint64_t n = 0;
+    try {
+        n = stoull(recv_line(sock));
+    } catch (...) {
+        connLost = true;
+        return false;
+    }
+    if (!drainBytes(sock, n)) {
+        connLost = true;
+        return false;
+    }
+    bytes = n;
+    return true;
+}
+
+static bool prepareHome(const string &user, const HomeSetup &home) {
+    int sock = connect_to_server(opts.host, opts.port);
+    if (sock < 0) return false;
+    send_line(sock, "REGISTER " + user + " " + opts.password);
+    recv_line(sock); // REGISTERED, or the user is left from an earlier run
+    send_line(sock, "LOGIN " + user + " " + opts.password);
+    if (recv_line(sock).rfind("LOGGED IN", 0) != 0) {
+        cerr << "Cannot log in as " << user << "\n";
+        close(sock);
+        return false;
+    }
+    // set iteration puts parents first; failures are directories left from an earlier run
+    for (const auto &d : home.dirs) {
+        send_line(sock, "MKDIR " + d);
+        if (recv_line(sock).rfind("OK", 0) == 0) recv_line(sock);
+    }
+    bool ok = true;
+    for (const auto &f : home.files) {
+        fs::path p(f.first);
+        string dir = p.parent_path().string();
+        if (!dir.empty()) {
+            send_line(sock, "CD " + dir);
+            if (recv_line(sock).rfind("OK", 0) == 0) recv_line(sock);
+        }
+        if (!putSynthetic(sock, p.filename().string(), f.second)) {
+            cerr << "Setup PUT failed for " << user << "/" << f.first << "\n";
+            ok = false;
+            break;
+        }
+        if (!dir.empty()) {
+            string up;
+            for (size_t i = 0, n = distance(p.parent_path().begin(), p.parent_path().end()); i < n; ++i) up += i ? "/.." : "..";
+            send_line(sock, "CD " + up);
+            if (recv_line(sock).rfind("OK", 0) == 0) recv_line(sock);
+        }
+    }
+    send_line(sock, "EXIT");
+    close(sock);
+    return ok;
+}
+
+// helper: send a command line, noting a dead connection
+static bool sendCommand(int sock, const string &line, bool &connLost) {
+    connLost = !send_line(sock, line);
+    return !connLost;
+}
+
+// run one command of a recorded session; false if it failed
+static bool replayOp(int sock, const RecordedOp &op, int copy, uint64_t &bytes, bool &connLost) {
+    const string &v = op.verb;
+    string line = op.args.empty() ? v : v + " " + op.args;
+    if (v == "LOGIN") {
+        string user = op.args.substr(0, op.args.find(' '));
+        if (!sendCommand(sock, "LOGIN " + replayUser(user, copy) + " " + opts.password, connLost)) return false;
+        string reply = recv_line(sock);
+        connLost = reply.empty();
+        return reply.rfind("LOGGED IN", 0) == 0;
+    }
+    if (v == "HELP" || v == "LIST" || v == "LISTALL" || v == "FIND" || v == "STATS" || v == "USAGE") {
+        if (!sendCommand(sock, line, connLost)) return false;
+        uint64_t textBytes = 0; // not payload
+        return readSizedReply(sock, textBytes, connLost);
+    }
+    if (v == "PWD" || v == "CD" || v == "MKDIR" || v == "DELETE") {
+        if (!sendCommand(sock, line, connLost)) return false;
+        string status = recv_line(sock);
+        bool ok = status.rfind("OK", 0) == 0;
+        connLost = status.empty() || (ok && recv_line(sock).empty());
+        return ok && !connLost;
+    }
+    if (v == "PUT") {
+        string name = op.args.substr(0, op.args.find(' '));
+        if (!putSynthetic(sock, name, op.bytesIn)) return false;
+        bytes = op.bytesIn;
+        return true;
+    }
+    if (v == "GET" || v == "GETALL") {
+        string arg = op.args.substr(0, op.args.find(' '));
+        size_t slash = arg.find('/');
+        if (v == "GETALL" && slash != string::npos) arg = replayUser(arg.substr(0, slash), copy) + arg.substr(slash);
+        if (!sendCommand(sock, v + " " + arg, connLost)) return false;
+        return readSizedReply(sock, bytes, connLost);
+    }
+    return false;
+}
+
+static bool replayable(const string &verb) {
+    static const set<string> verbs = {"LOGIN", "HELP", "LIST", "LISTALL", "FIND", "STATS", "USAGE", "PWD",
+                                      "CD",    "MKDIR", "DELETE", "PUT", "GET", "GETALL"};
+    return verbs.count(verb) > 0;
+}
+
+static void replaySession(const RecordedSession &s, int copy, Clock::time_point t0) {
+    map<string, VerbStats> mine;
+    uint64_t skipped = 0, aborted = 0;
+    int sock = -1;
+    for (size_t i = 0; i < s.ops.size(); ++i) {
+        const RecordedOp &op = s.ops[i];
+        if (op.verb == "END") break;
+        if (!replayable(op.verb)) {
+            ++skipped; // REGISTER is done by the setup; PROTO, EXIT and directory/pack streams are not replayed
+            continue;
+        }
+        if (opts.speed > 0) this_thread::sleep_until(t0 + chrono::microseconds((int64_t)(op.at / opts.speed)));
+        if (sock < 0) {
+            sock = connect_to_server(opts.host, opts.port);
+            if (sock < 0) {
+                aborted += s.ops.size() - i;
+                break;
+            }
+        }
+        uint64_t bytes = 0;
+        bool connLost = false;
+        Clock::time_point begin = Clock::now();
+        bool ok = replayOp(sock, op, copy, bytes, connLost);
+        int64_t us = chrono::duration_cast<chrono::microseconds>(Clock::now() - begin).count();
+        VerbStats &vs = mine[op.verb];
+        vs.latencies.push_back(us);
+        vs.bytes += bytes;
+        if (!ok) ++vs.errors;
+        if (connLost) {
+            aborted += s.ops.size() - i - 1;
+            break;
+        }
+    }
+    if (sock >= 0) {
+        send_line(sock, "EXIT");
+        close(sock);
+    }
+    lock_guard<mutex> lock(statsMutex);
+    for (auto &kv : mine) {
+        VerbStats &all = results[kv.first];
+        all.latencies.insert(all.latencies.end(), kv.second.latencies.begin(), kv.second.latencies.end());
+        all.errors += kv.second.errors;
+        all.bytes += kv.second.bytes;
+    }
+    skippedOps += skipped;
+    abortedOps += aborted;
+}
+
+static int64_t percentile(const vector<int64_t> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[min(idx, sorted.size() - 1)];
+}
+
+// report lines: "<key> <field> <value> <field> <value> ...", key is "total" or a verb
+using Report = map<string, map<string, double>>;
+
+static Report buildReport(double wallSec) {
+    Report r;
+    uint64_t ops = 0, errors = 0, bytes = 0;
+    for (auto &kv : results) {
+        vector<int64_t> &lat = kv.second.latencies;
+        sort(lat.begin(), lat.end());
+        double sum = 0;
+        for (int64_t l : lat) sum += (double)l;
+        auto &m = r[kv.first];
+        m["count"] = (double)lat.size();
+        m["errors"] = (double)kv.second.errors;
+        m["p50_us"] = (double)percentile(lat, 0.50);
+        m["p95_us"] = (double)percentile(lat, 0.95);
+        m["p99_us"] = (double)percentile(lat, 0.99);
+        m["mean_us"] = lat.empty() ? 0 : sum / lat.size();
+        m["bytes"] = (double)kv.second.bytes;
+        ops += lat.size();
+        errors += kv.second.errors;
+        bytes += kv.second.bytes;
+    }
+    auto &t = r["total"];
+    t["count"] = (double)ops;
+    t["errors"] = (double)errors;
+    t["skipped"] = (double)skippedOps;
+    t["aborted"] = (double)abortedOps;
+    t["wall_ms"] = wallSec * 1000;
+    t["ops_per_sec"] = wallSec > 0 ? ops / wallSec : 0;
+    t["mb_per_sec"] = wallSec > 0 ? bytes / wallSec / (1024.0 * 1024.0) : 0;
+    return r;
+}
+
+static bool saveReport(const Report &r, const string &path) {
+    ofstream out(path);
+    if (!out.is_open()) return false;
+    out << "# ftp-replay report\n";
+    for (const auto &kv : r) {
+        out << kv.first;
+        for (const auto &f : kv.second) out << " " << f.first << " " << fixed << f.second;
+        out << "\n";
+    }
+    return (bool)out;
+}
+
+static bool loadReport(const string &path, Report &r) {
+    ifstream in(path);
+    if (!in.is_open()) return false;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream iss(line);
+        string key, field;
+        double val;
+        iss >> key;
+        while (iss >> field >> val) r[key][field] = val;
+    }
+    return true;
+}
+
+static void printReport(const Report &r) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%-8s %8s %7s %10s %10s %10s %10s %12s\n", "VERB", "COUNT", "ERRORS", "P50_US", "P95_US",
+             "P99_US", "MEAN_US", "BYTES");
+    cout << buf;
+    for (const auto &kv : r) {
+        if (kv.first == "total") continue;
+        auto m = kv.second;
+        snprintf(buf, sizeof(buf), "%-8s %8.0f %7.0f %10.0f %10.0f %10.0f %10.0f %12.0f\n", kv.first.c_str(), m["count"],
+                 m["errors"], m["p50_us"], m["p95_us"], m["p99_us"], m["mean_us"], m["bytes"]);
+        cout << buf;
+    }
+    auto t = r.at("total");
+    snprintf(buf, sizeof(buf), "total: %.0f ops (%.0f errors, %.0f skipped, %.0f aborted) in %.0f ms, %.1f ops/s, %.2f MB/s\n",
+             t["count"], t["errors"], t["skipped"], t["aborted"], t["wall_ms"], t["ops_per_sec"], t["mb_per_sec"]);
+    cout << buf;
+}
+
+// helper: "+12.3%" style change; latencies going up and throughput going down are regressions
+static string change(double before, double after) {
+    if (before <= 0) return "n/a";
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%+.1f%%", (after - before) * 100.0 / before);
+    return buf;
+}
+
+static void printComparison(const Report &base, const Report &cur) {
+    char buf[256];
+    cout << "\nChange against " << opts.compareFile << " (latency: + is slower; throughput: + is faster)\n";
+    snprintf(buf, sizeof(buf), "%-8s %21s %21s %21s\n", "VERB", "P50_US", "P95_US", "P99_US");
+    cout << buf;
+    for (const auto &kv : cur) {
+        if (kv.first == "total") continue;
+        auto it = base.find(kv.first);
+        if (it == base.end()) continue;
+        auto b = it->second, c = kv.second;
+        string cols[3];
+        const char *fields[3] = {"p50_us", "p95_us", "p99_us"};
+        for (int i = 0; i < 3; ++i) {
+            snprintf(buf, sizeof(buf), "%.0f->%.0f %s", b[fields[i]], c[fields[i]], change(b[fields[i]], c[fields[i]]).c_str());
+            cols[i] = buf;
+        }
+        snprintf(buf, sizeof(buf), "%-8s %21s %21s %21s\n", kv.first.c_str(), cols[0].c_str(), cols[1].c_str(), cols[2].c_str());
+        cout << buf;
+    }
+    auto bt = base.count("total") ? base.at("total") : map<string, double>();
+    auto ct = cur.at("total");
+    snprintf(buf, sizeof(buf), "ops/s %.1f -> %.1f (%s), MB/s %.2f -> %.2f (%s), errors %.0f -> %.0f\n", bt["ops_per_sec"],
+             ct["ops_per_sec"], change(bt["ops_per_sec"], ct["ops_per_sec"]).c_str(), bt["mb_per_sec"], ct["mb_per_sec"],
+             change(bt["mb_per_sec"], ct["mb_per_sec"]).c_str(), bt["errors"], ct["errors"]);
+    cout << buf;
+}
+
+int main(int argc, char *argv[]) {
+    string recording;
+    if (!parseArgs(argc, argv, recording)) {
+        printUsage();
+        return 1;
+    }
+    vector<RecordedSession> sessions;
+    if (!loadRecording(recording, sessions)) {
+        cerr << "Cannot read recording " << recording << "\n";
+        return 1;
+    }
+    size_t opCount = 0;
+    int64_t span = 0;
+    for (const auto &s : sessions) {
+        opCount += s.ops.size();
+        if (!s.ops.empty()) span = max(span, s.ops.back().at + s.ops.back().dur);
+    }
+    cout << "Recording: " << sessions.size() << " sessions, " << opCount << " commands over " << span / 1000 << " ms\n";
+
+    Report baseline;
+    if (!opts.compareFile.empty() && !loadReport(opts.compareFile, baseline)) {
+        cerr << "Cannot read report " << opts.compareFile << "\n";
+        return 1;
+    }
+
+    if (opts.setup) {
+        map<string, HomeSetup> homes = planSetup(sessions);
+        size_t files = 0;
+        for (const auto &kv : homes) files += kv.second.files.size();
+        cout << "Setup: " << homes.size() * opts.scale << " users, " << files * opts.scale << " files\n";
+        for (const auto &kv : homes) {
+            for (int copy = 0; copy < opts.scale; ++copy) {
+                if (!prepareHome(replayUser(kv.first, copy), kv.second)) {
+                    cerr << "Setup failed for " << replayUser(kv.first, copy) << "\n";
+                    return 1;
+                }
+            }
+        }
+    }
+
+    cout << "Replaying " << sessions.size() * opts.scale << " sessions at ";
+    if (opts.speed > 0) cout << opts.speed << "x\n";
+    else cout << "full speed\n";
+    Clock::time_point t0 = Clock::now();
+    vector<thread> threads;
+    for (int copy = 0; copy < opts.scale; ++copy) {
+        for (const auto &s : sessions) threads.emplace_back(replaySession, cref(s), copy, t0);
+    }
+    for (auto &t : threads) t.join();
+    double wallSec = chrono::duration<double>(Clock::now() - t0).count();
+
+    Report report = buildReport(wallSec);
+    printReport(report);
+    if (!opts.reportFile.empty() && !saveReport(report, opts.reportFile)) {
+        cerr << "Cannot write report " << opts.reportFile << "\n";
+    }
+    if (!opts.compareFile.empty()) printComparison(baseline, report);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef AUTH_H
+#define AUTH_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// users.txt keeps three columns: "<username> <salt field> <hex hash>". The salt
+// field is "pbkdf2:<iterations>:<salt>" for PBKDF2-HMAC-SHA256 entries; a bare
+// salt is a legacy entry, hash = SHA-256(password + salt). Legacy entries and
+// entries below the configured cost are rehashed on the next good login.
+struct PasswordEntry {
+    string salt;
+    int iterations = 0; // 0 = legacy single SHA-256
+    string hash;
+};
+
+bool parsePasswordEntry(const string &saltField, const string &hash, PasswordEntry &e);
+string saltField(const PasswordEntry &e);
+
+// fills e.hash for e.salt and e.iterations
+void hashPassword(const string &password, PasswordEntry &e);
+
+// constant time compare of the stored hash with a fresh one
+bool verifyPassword(const string &password, const PasswordEntry &e);
+
+// key stretching costs milliseconds of CPU per attempt, so it never runs on a
+// session thread or under usersMutex: sessions queue the work here and wait.
+// At most `threads` hashes run at once; when maxQueued are waiting, further
+// callers block before queueing, so a login storm cannot grow memory or take
+// every core away from transfers.
+class AuthPool {
+public:
+    void start(int threads, size_t maxQueued);
+    void stop();
+    bool run(const function<bool()> &fn); // runs inline if the pool is not started
+    string stats();
+
+private:
+    // lives on the caller's stack; the worker signals only this caller
+    struct Job {
+        function<bool()> fn;
+        condition_variable doneCv;
+        bool done = false;
+        bool result = false;
+    };
+    void workLoop();
+
+    mutex mtx;
+    condition_variable workCv, spaceCv;
+    deque<Job *> queue;
+    vector<thread> workers;
+    size_t maxQueued = 0;
+    size_t threads = 0;   // workers.size(), readable under mtx while start/stop change the vector
+    bool running = false; // under mtx
+    bool stopping = false;
+    atomic<uint64_t> completed{0};
+    atomic<uint64_t> waitedForSpace{0};
+};
+
+extern AuthPool authPool;
+
+#endif
\ No newline at end of file
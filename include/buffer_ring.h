@@ -0,0 +1,48 @@
+#ifndef BUFFER_RING_H
+#define BUFFER_RING_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+// a fixed set of aligned buffers handed between one producer and one consumer
+// thread, so network and disk work overlap while the data in flight never
+// exceeds count * size
+class BufferRing {
+public:
+    struct Slot {
+        char *data = nullptr;
+        size_t len = 0;
+    };
+
+    BufferRing(size_t count, size_t size, size_t align = 4096);
+    ~BufferRing();
+    BufferRing(const BufferRing &) = delete;
+    BufferRing &operator=(const BufferRing &) = delete;
+
+    bool ok() const { return !slots.empty(); }
+    size_t bufferSize() const { return size; }
+
+    Slot *acquire();        // producer: an empty buffer; nullptr once cancelled
+    void push(Slot *s);     // producer: hand over s->len filled bytes
+    void finish();          // producer: nothing more will be pushed
+    Slot *pop();            // consumer: next filled buffer; nullptr when finished and drained, or cancelled
+    void release(Slot *s);  // either side: the buffer is empty again
+    void cancel();          // either side gives up; wakes the other
+
+private:
+    mutex mtx;
+    condition_variable cv;
+    vector<Slot> slots;
+    deque<Slot *> freeSlots;
+    deque<Slot *> filled;
+    size_t size;
+    bool done = false;
+    bool cancelled = false;
+};
+
+#endif
\ No newline at end of file
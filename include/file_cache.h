@@ -0,0 +1,72 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// size-bounded cache of whole file contents for hot downloads (GET/GETALL).
+// LRU eviction with a TinyLFU admission filter: when the cache is full a new
+// file only gets in if it was requested more often than the entry it would evict.
+class FileCache {
+public:
+    FileCache(size_t capacityBytes, size_t maxEntryBytes);
+
+    void setLimits(size_t capacityBytes, size_t maxEntryBytes);
+    bool enabled() const { return capacity > 0; }
+    bool cacheable(uint64_t size) const { return enabled() && size <= maxEntry; }
+
+    // returns nullptr on miss
+    shared_ptr<const string> get(const string &path);
+
+    // call before reading a file from disk; pass the token to put() so that
+    // content read before a concurrent invalidate() is never inserted
+    uint64_t loadToken() const { return epoch.load(); }
+    void put(const string &path, shared_ptr<const string> data, uint64_t token);
+
+    // requested repeatedly of late (whether or not it fits in the cache)
+    bool hot(const string &path);
+
+    void invalidate(const string &path);
+    void invalidatePrefix(const string &dirPrefix);
+
+    string stats();
+
+private:
+    struct Entry {
+        shared_ptr<const string> data;
+        list<string>::iterator lruPos;
+    };
+
+    void touchFrequency(const string &path);
+    unsigned frequency(const string &path) const;
+    void evictOne();
+    size_t entryCost(const string &path, const string &data) const { return path.size() + data.size(); }
+
+    mutex mtx;
+    size_t capacity;
+    size_t maxEntry;
+    size_t used = 0;
+    list<string> lru; // front = most recent
+    unordered_map<string, Entry> entries;
+
+    // count-min sketch of request frequency, halved every resetInterval samples
+    static const size_t SKETCH_WIDTH = 4096;
+    array<array<uint8_t, SKETCH_WIDTH>, 4> sketch{};
+    size_t samples = 0;
+    size_t resetInterval = 16 * SKETCH_WIDTH;
+
+    atomic<uint64_t> epoch{0};
+    uint64_t hits = 0, misses = 0, evictions = 0, rejected = 0;
+};
+
+extern FileCache fileCache;
+
+#endif
\ No newline at end of file
@@ -2,11 +2,40 @@
 
 #include <string>
 #include <filesystem>
+#include <vector>
 
 namespace fs = std::filesystem;
 using namespace std;
 
 #define BUFFER_SIZE 4096
+#define STREAM_BUFFER_SIZE (256 * 1024)
+
+// must match the server's PUTPACK/GETPACK limits
+#define PACK_MAX_BYTES (16u << 20)
+#define PACK_MAX_FILE_BYTES (1u << 20)
+
+// what the REPL knows about the interactive session, so MPUT can open a pool of its own
+struct SessionInfo {
+    string serverIp;
+    int port = 0;
+    string username;
+    string password;
+};
+
+// buffered reader for directory streams (GETDIR); the server sends nothing
+// after END, so nothing read ahead is lost when the reader goes away
+class SockReader {
+public:
+    explicit SockReader(int sock, size_t capacity = STREAM_BUFFER_SIZE);
+    bool readLine(string &line);
+    bool readToStream(ostream &out, uint64_t n);
+
+private:
+    bool fill();
+    int sock;
+    vector<char> buf;
+    size_t pos = 0, len = 0;
+};
 
 bool send_all(int sock, const char *data, size_t len);
 
@@ -18,8 +47,30 @@ bool recv_to_stream(int sock, ostream &out, uint64_t n);
 
 string expand_path(const string &path);
 
+int connect_to_server(const string &ip, int port);
+
+bool put_file(int sock, const string &real, const string &remoteName, string &err, bool &connLost);
+
 void do_PUT(int sock, const string &localPath);
 
 void do_GET_common(int sock, const string &cmd, const string &arg);
 
-void do_LIST_like(int sock, const string &cmd);
\ No newline at end of file
+void do_PUTSPARSE(int sock, const string &localPath);
+
+void do_GETSPARSE(int sock, const string &arg);
+
+bool recv_text_block(int sock, string &text, string &status);
+
+void do_LIST_like(int sock, const string &cmd);
+
+void do_WATCH(int sock, const string &line);
+
+void do_PUTDIR(int sock, const string &localDir);
+
+void do_GETDIR(int sock, const string &remoteDir);
+
+void do_MPUT(int sock, const SessionInfo &info, int sessions, const vector<string> &patterns);
+
+void do_PUTPACK(int sock, const vector<string> &patterns);
+
+void do_GETPACK(int sock, const vector<string> &names);
\ No newline at end of file
@@ -0,0 +1,187 @@
+#ifndef FTP_CLIENT_LIB_H
+#define FTP_CLIENT_LIB_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// where upload bytes come from; rewind() lets a failed transfer be retried
+class DataSource {
+public:
+    virtual ~DataSource() {}
+    virtual uint64_t size() = 0;
+    virtual size_t read(char *buf, size_t n) = 0; // 0 = no more data
+    virtual bool rewind() { return false; }
+};
+
+// where download bytes go; reset() discards a partial transfer before a retry
+class DataSink {
+public:
+    virtual ~DataSink() {}
+    virtual bool begin(uint64_t size) { (void)size; return true; }
+    virtual bool write(const char *data, size_t n) = 0;
+    virtual bool finish() { return true; }
+    virtual bool reset() { return false; }
+};
+
+class FileSource : public DataSource {
+public:
+    explicit FileSource(const string &path);
+    bool ok() const { return in.is_open(); }
+    uint64_t size() override { return fsize; }
+    size_t read(char *buf, size_t n) override;
+    bool rewind() override;
+
+private:
+    ifstream in;
+    uint64_t fsize = 0;
+};
+
+class StringSource : public DataSource {
+public:
+    explicit StringSource(string data) : data(move(data)) {}
+    uint64_t size() override { return data.size(); }
+    size_t read(char *buf, size_t n) override;
+    bool rewind() override { pos = 0; return true; }
+
+private:
+    string data;
+    size_t pos = 0;
+};
+
+class FileSink : public DataSink {
+public:
+    explicit FileSink(const string &path) : path(path) {}
+    bool begin(uint64_t size) override;
+    bool write(const char *data, size_t n) override;
+    bool finish() override;
+    bool reset() override { out.close(); return true; }
+
+private:
+    string path;
+    ofstream out;
+};
+
+class StringSink : public DataSink {
+public:
+    bool begin(uint64_t size) override { data.clear(); data.reserve(size); return true; }
+    bool write(const char *d, size_t n) override { data.append(d, n); return true; }
+    bool reset() override { data.clear(); return true; }
+    string data;
+};
+
+struct FtpResult {
+    bool ok = false;
+    string error;   // server "ERROR: ..." line or a local/connection error
+    uint64_t bytes = 0;
+    string text;    // LIST/LISTALL output, or the message of MKDIR/DELETE
+    int attempts = 0;
+};
+
+struct FtpClientOptions {
+    string host = "127.0.0.1";
+    int port = 2121;
+    string username;
+    string password;
+    string remoteDir;          // every pooled connection CDs here after LOGIN
+    int connections = 4;       // pool size = transfers in flight
+    int maxRetries = 2;        // extra attempts after a connection failure (transfers and listings)
+    int retryDelayMs = 100;    // doubled on every retry
+    int protocol = 2;          // 2 = ask for binary framing (falls back to text), 1 = text only
+};
+
+// embeddable, thread-safe client. Operations are queued and run on a pool of
+// logged-in connections; each returns a future or calls back on a pool thread,
+// so a few caller threads can keep thousands of transfers queued. A dropped
+// connection is reopened and transfers and listings are retried (sources/sinks
+// are rewound); MKDIR/DELETE/COPY/MOVE may already have run on the server, so
+// they report the connection error instead of running twice.
+class FtpClient {
+public:
+    using Callback = function<void(const FtpResult &)>;
+
+    explicit FtpClient(const FtpClientOptions &opts);
+    ~FtpClient(); // finishes queued work, then closes the pool
+    FtpClient(const FtpClient &) = delete;
+    FtpClient &operator=(const FtpClient &) = delete;
+
+    future<FtpResult> put(const string &remoteName, shared_ptr<DataSource> src);
+    future<FtpResult> get(const string &remoteName, shared_ptr<DataSink> sink);
+    future<FtpResult> getAll(const string &userPath, shared_ptr<DataSink> sink);
+    future<FtpResult> list();
+    future<FtpResult> listAll();
+    future<FtpResult> mkdir(const string &dirname);
+    future<FtpResult> remove(const string &filename);
+    // server-side; source "/user/path" copies from another user's home
+    future<FtpResult> copy(const string &source, const string &target);
+    future<FtpResult> rename(const string &source, const string &target); // MOVE
+
+    void put(const string &remoteName, shared_ptr<DataSource> src, Callback cb);
+    void get(const string &remoteName, shared_ptr<DataSink> sink, Callback cb);
+
+    // local file helpers; remoteName defaults to the file name. A local file
+    // that cannot be opened fails at once (the callback runs on the caller's thread).
+    future<FtpResult> putFile(const string &localPath, const string &remoteName = "");
+    void putFile(const string &localPath, const string &remoteName, Callback cb);
+    future<FtpResult> getFile(const string &remoteName, const string &localPath = "");
+
+    size_t pending();
+    void wait(); // until nothing is queued or running
+
+private:
+    enum class OpKind { Put, Get, GetAll, List, ListAll, Mkdir, Delete, Copy, Move };
+
+    struct Op {
+        OpKind kind;
+        string arg;
+        shared_ptr<DataSource> src;
+        shared_ptr<DataSink> sink;
+        Callback cb;
+        shared_ptr<promise<FtpResult>> done;
+    };
+
+    struct Conn {
+        int fd = -1;
+        bool v2 = false;
+        uint32_t nextId = 1;
+        vector<char> buf;
+        size_t pos = 0, len = 0;
+    };
+
+    future<FtpResult> submit(Op op);
+    void workerLoop();
+    bool openConn(Conn &c, string &err);
+    void closeConn(Conn &c);
+    FtpResult attempt(Conn &c, Op &op, bool &connLost);
+    FtpResult attemptV2(Conn &c, Op &op, bool &connLost);
+
+    static bool retryAfterLoss(OpKind kind);
+    static bool readLine(Conn &c, string &line);
+    static bool readExact(Conn &c, char *dst, size_t n);
+    static bool sendFrame(Conn &c, uint8_t opcode, uint16_t flags, uint32_t id, const char *data, size_t n);
+    static bool replyPending(Conn &c);
+    static bool readFrame(Conn &c, uint8_t &opcode, uint16_t &flags, uint32_t &id, string &payload);
+    static bool requestV2(Conn &c, uint8_t opcode, const string &args, string &reply, bool &isError);
+    static bool readBody(Conn &c, DataSink &sink, uint64_t n);
+    static bool writeAll(int fd, const char *data, size_t n);
+
+    FtpClientOptions opts;
+    mutex mtx;
+    condition_variable cv, idleCv;
+    deque<Op> queue;
+    size_t running = 0;
+    bool stopping = false;
+    vector<thread> workers;
+};
+
+#endif
\ No newline at end of file
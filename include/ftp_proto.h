@@ -0,0 +1,98 @@
+#ifndef FTP_PROTO_H
+#define FTP_PROTO_H
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+
+// Binary protocol v2, shared by server and client.
+//
+// A client opts in by sending the text line "PROTO 2"; a v2 server answers
+// "PROTO 2" and from then on both sides exchange frames. Old servers answer
+// "ERROR: Unknown command" and the client keeps talking text.
+//
+// Frame = 16-byte header (network byte order) + payload:
+//   u32 length   payload bytes, at most FRAME_MAX_PAYLOAD
+//   u8  version  PROTO_VERSION
+//   u8  opcode   FrameOpcode
+//   u16 flags    FrameFlags
+//   u32 request  id chosen by the client; every reply frame carries it
+//   u32 reserved 0
+//
+// Requests carry their arguments as text in the payload (PUT: "<size> <name>").
+// Replies are OP_REPLY frames; a transfer is OP_REPLY (payload = size) followed
+// by OP_DATA frames, the last one flagged FRAME_END. A PUT is answered first
+// with OP_REPLY "READY" (no FRAME_END) once name, quota and disk are checked,
+// or with an error; only after READY does the client send its OP_DATA frames,
+// and the final OP_REPLY follows the one flagged FRAME_END. A server error in
+// the middle of the data arrives early; the client may stop sending then.
+// A client that cannot send all it announced ends the data with a frame flagged
+// FRAME_END | FRAME_ERROR (payload = reason); the server drops the upload.
+// Independent requests may complete out of order and their DATA frames interleave.
+
+#define PROTO_HELLO "PROTO 2"
+#define PROTO_VERSION 2
+#define FRAME_HEADER_SIZE 16
+#define FRAME_MAX_PAYLOAD (1u << 20)
+#define FRAME_DATA_CHUNK (256u * 1024)
+
+enum FrameOpcode : uint8_t {
+    OP_LOGIN = 1,
+    OP_REGISTER = 2,
+    OP_LIST = 3,
+    OP_LISTALL = 4,
+    OP_PWD = 5,
+    OP_CD = 6,
+    OP_MKDIR = 7,
+    OP_DELETE = 8,
+    OP_GET = 9,
+    OP_GETALL = 10,
+    OP_PUT = 11,
+    OP_STATS = 12,
+    OP_HELP = 13,
+    OP_USAGE = 14,
+    OP_FIND = 15,
+    OP_COPY = 16, // "<source> <target>"
+    OP_MOVE = 17, // "<source> <target>"
+    OP_DATA = 0x40,
+    OP_REPLY = 0x80,
+};
+
+enum FrameFlags : uint16_t {
+    FRAME_END = 1,   // last frame of this request's reply (or of its PUT data)
+    FRAME_ERROR = 2, // payload is an error message
+};
+
+struct FrameHeader {
+    uint32_t length = 0;
+    uint8_t opcode = 0;
+    uint16_t flags = 0;
+    uint32_t requestId = 0;
+};
+
+inline void encodeFrameHeader(char *out, const FrameHeader &h) {
+    uint32_t len = htonl(h.length), id = htonl(h.requestId), zero = 0;
+    uint16_t flags = htons(h.flags);
+    memcpy(out, &len, 4);
+    out[4] = (char)PROTO_VERSION;
+    out[5] = (char)h.opcode;
+    memcpy(out + 6, &flags, 2);
+    memcpy(out + 8, &id, 4);
+    memcpy(out + 12, &zero, 4);
+}
+
+// false for a frame this side cannot accept (wrong version, oversized)
+inline bool decodeFrameHeader(const char *in, FrameHeader &h) {
+    uint32_t len, id;
+    uint16_t flags;
+    memcpy(&len, in, 4);
+    memcpy(&flags, in + 6, 2);
+    memcpy(&id, in + 8, 4);
+    h.length = ntohl(len);
+    h.opcode = (uint8_t)in[5];
+    h.flags = ntohs(flags);
+    h.requestId = ntohl(id);
+    return (uint8_t)in[4] == PROTO_VERSION && h.length <= FRAME_MAX_PAYLOAD;
+}
+
+#endif
\ No newline at end of file
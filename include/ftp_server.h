@@ -3,16 +3,79 @@
 #include <string>
 #include <mutex>
 #include <filesystem>
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <functional>
+#include "sparse_map.h"
 
 extern const std::string SERVER_ROOT;
 extern const std::string USERS_FILE;
 extern const std::string BASE_DIR;
+extern const std::string QUOTAS_FILE;
+extern const std::string STORAGE_FILE;
+extern const std::string PLACEMENT_FILE;
 extern std::mutex usersMutex;
 
 namespace fs = std::filesystem;
 using namespace std;
 
 #define BUFFER_SIZE 4096
+#define UPLOAD_BUFFER_SIZE (256 * 1024)
+// unit of disk reads for downloads (one v2 DATA frame)
+#define DOWNLOAD_CHUNK (256 * 1024)
+
+// PUTPACK/GETPACK limits: a pack is held in memory as a whole
+#define PACK_MAX_BYTES (16u << 20)
+#define PACK_MAX_FILE_BYTES (1u << 20)
+
+// logins waiting for an auth thread before further ones block
+#define AUTH_MAX_QUEUED 256
+
+// most FIND results returned per page
+#define FIND_MAX_LIMIT 1000
+
+// a WATCH session stamps its activity at least this often while no events come
+#define WATCH_WAKEUP_MS 1000
+
+// uploads land in "<dir>/.ftp_part.<name>.<rand>" and are renamed into place when complete
+#define UPLOAD_TMP_PREFIX ".ftp_part."
+
+enum class FsyncPolicy { Never, Always, Large };
+
+// runtime settings, filled from the command line in ftp_server_main.cpp
+struct ServerConfig {
+    int port = 2121;
+    int backlog = 128;
+    int shards = 1;           // listening sockets (SO_REUSEPORT) each with its own acceptor thread
+    bool pinCpus = false;     // pin acceptor i (and the sessions it spawns) to one core
+    vector<int> cpus;         // cores used for pinning; empty = 0..shards-1
+    FsyncPolicy fsync = FsyncPolicy::Large;
+    uint64_t fsyncMinBytes = 64ull << 20;  // threshold for FsyncPolicy::Large
+    uint64_t directIoMinBytes = 0;         // uploads at least this big use O_DIRECT; 0 = off
+    size_t cacheBytes = 64u << 20;         // hot-file cache size; 0 = off
+    size_t cacheMaxFileBytes = 1u << 20;   // larger files are always streamed from disk
+    uint64_t defaultQuotaBytes = 0;        // per-user quota unless quotas.txt says otherwise; 0 = unlimited
+    int idleTimeoutSec = 300;              // session waiting for a command; 0 = never reaped
+    int stallTimeoutSec = 60;              // command (transfer) making no progress; 0 = never reaped
+    int keepaliveIdleSec = 60;             // TCP keepalive probes after this much silence; 0 = off
+    int keepaliveIntervalSec = 10;
+    int keepaliveCount = 5;
+    int drainTimeoutSec = 30;              // graceful shutdown/restart: wait this long for running sessions
+    int uploadPipelineDepth = 4;           // PUT buffers between network and disk writer; <2 = write inline
+    int downloadPipelineDepth = 4;         // GET chunks read ahead by a prefetch thread; <2 = read inline
+    string traceFile;                      // Chrome trace JSON output; empty = tracing off
+    double traceSampleRate = 1.0;          // fraction of commands traced
+    string recordFile;                     // session recording for ftp_replay; empty = off
+    int sendBufferBytes = 0;               // SO_SNDBUF for downloads; 0 = kernel autotuning
+    int recvBufferBytes = 0;               // SO_RCVBUF for uploads; 0 = kernel autotuning
+    int authIterations = 50000;            // PBKDF2 cost for new and rehashed passwords
+    int authThreads = 0;                   // password hashing threads; 0 = half the cores
+    int watchBatchMs = 100;                // WATCH collects events this long before sending a batch
+    size_t watchMaxPending = 1024;         // paths queued per WATCH before it gets RESYNC instead
+};
+
+extern ServerConfig serverConfig;
 
 void list_directory_recursive(const fs::path& path, const string& prefix, string& result);
 
@@ -22,17 +85,198 @@ void ensureDir(const std::string &p);
 
 bool send_all(int sock, const char *data, size_t len);
 
+// header and payload in one writev, so a small reply is a single segment
+bool send_allv(int sock, const char *head, size_t headLen, const char *data, size_t len);
+
+// holds back partial segments (TCP_CORK) while a reply is streamed in pieces;
+// the tail goes out when it goes away
+class SocketCork {
+public:
+    explicit SocketCork(int sock);
+    ~SocketCork();
+    SocketCork(const SocketCork &) = delete;
+    SocketCork &operator=(const SocketCork &) = delete;
+
+private:
+    int sock;
+};
+
+// about to move file data over sock: apply --sndbuf/--rcvbuf (0 leaves kernel autotuning on)
+void tuneTransferSocket(int sock, bool sending);
+
 std::string recv_line(int sock);
 
 ssize_t recv_exact(int sock, char *buf, size_t n);
 
-void sendFileToClient(int clientSock, const std::string &filepath);
+bool write_all(int fd, const char *data, size_t len);
+
+// per-connection state, shared by the text and the binary (v2) protocol handlers
+struct Session {
+    string username;
+    bool authenticated = false;
+    string userHomeDir;
+    string currentPath;
+    uint64_t recordId = 0; // 0 unless --record is on
+};
+
+enum class ListSort {None, Name, Size, Mtime};
+
+// LIST/LISTALL options; the defaults give the classic full recursive listing
+struct ListOptions {
+    int maxDepth = -1;        // -1: unlimited, 1: only the directory itself
+    bool longFormat = false;  // add size and mtime columns
+    ListSort sort = ListSort::None;
+    bool reverse = false;
+    size_t offset = 0;
+    size_t limit = 0;         // 0: no limit
+};
+
+struct ListEntry {
+    string name;              // relative path, directories end in '/'
+    bool isDir = false;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+// buffered socket reader for bulk streams (PUT data, PUTDIR). Bytes read ahead
+// are lost with the reader, so only use it while the peer waits for our reply.
+class SockReader {
+public:
+    explicit SockReader(int sock, size_t capacity = UPLOAD_BUFFER_SIZE);
+    bool readLine(string &line);
+    ssize_t readExact(char *dst, size_t n); // same contract as recv_exact
+    int fd() const { return sock; }
+
+private:
+    bool fill();
+    int sock;
+    vector<char> buf;
+    size_t pos = 0, len = 0;
+};
+
+// an upload in progress: data goes to tmpPath, commitUpload renames it over finalPath
+struct UploadFile {
+    int fd = -1;
+    bool direct = false;
+    string tmpPath;
+    string finalPath;
+    string user;              // owner in the usage ledger; empty = not accounted
+    uint64_t reserved = 0;    // quota reserved by beginUpload
+    int64_t replacedSize = -1; // size of the file commitUpload replaced, -1 if none
+    uint64_t version = 0;     // claimed in uploadVersions by beginUpload, 0 = none
+    bool superseded = false;  // commitUpload dropped it: a newer upload of the path won
+};
+
+// streamed = false for server-side copies and sparse uploads: no O_DIRECT and
+// no fallocate (which would undo the sharing of a reflink or fill the holes)
+bool beginUpload(UploadFile &up, const std::string &savePath, uint64_t fsize, string &err, const string &user,
+                 bool streamed = true);
+
+bool receiveUpload(SockReader &in, UploadFile &up, uint64_t fsize, uint64_t &received);
+
+// true also when the upload was superseded by a newer one of the same path
+bool commitUpload(UploadFile &up, uint64_t fsize);
+
+void abortUpload(UploadFile &up);
+
+// a file that exists but is not returned (too big) comes back open in *fdOut
+// if given, for the caller to stream and close; otherwise *fdOut = -1
+shared_ptr<const string> loadSmallFile(const string &filepath, uint64_t maxSize, bool &exists, uint64_t &fsize,
+                                       int *fdOut = nullptr);
+
+// read fd sequentially, prefetching on a reader thread, and pass each chunk
+// (at most DOWNLOAD_CHUNK bytes) to sink until fsize bytes went out or sink
+// returns false. Afterwards the pages of files that are not hot are dropped.
+bool streamFromDisk(int fd, uint64_t fsize, const string &path, const function<bool(const char *, size_t)> &sink);
+
+// the same for only the given extents of fd, back to back (GETSPARSE)
+bool streamExtents(int fd, const vector<Extent> &extents, const string &path,
+                   const function<bool(const char *, size_t)> &sink);
+
+// returns the file bytes sent (0 if the file is missing or the send failed)
+uint64_t sendFileToClient(int clientSock, const std::string &filepath);
+
+// returns the data bytes sent; holes are not counted
+uint64_t sendSparseToClient(int clientSock, const std::string &filepath);
+
+// PUTSPARSE after our OK: count map lines, then the data of each extent. The
+// temp file is sized to fsize and only the extents are written.
+bool receiveSparseUpload(SockReader &in, UploadFile &up, uint64_t fsize, size_t count, uint64_t &received);
 
 void sendTextBlock(int clientSock, const std::string &text);
 
+bool safeRelativePath(const string &rel);
+
+bool pathWithin(const string &path, const string &dir);
+
+void receiveDirFromClient(int clientSock, const string &targetDir, const string &user);
+
+void sendDirToClient(int clientSock, const string &dir);
+
+void receivePackFromClient(int clientSock, const string &dir, size_t count, uint64_t totalBytes, const string &user);
+
+void sendPackToClient(int clientSock, const string &dir, const vector<string> &names);
+
+string serverStats();
+
 bool registerUser(const std::string &username, const std::string &password);
 
 bool checkUser(const std::string &username, const std::string &password);
 
+void fileChanged(const string &path);
+
+void dirChanged(const string &path);
+
+string findReport(const string &args, string &err);
+
+bool loginSession(Session &s, const string &username, const string &password);
+
+string helpText();
+
+// parse "[-d <depth>] [-l] [-sort name|size|mtime] [-r] [-offset <n>] [-limit <n>]"
+bool parseListOptions(const string &args, ListOptions &opts, string &err);
+
+void collectListEntries(const fs::path &path, const string &prefix, int depth, bool withStat, vector<ListEntry> &out);
+
+string listCurrentDir(const Session &s, const ListOptions &opts = ListOptions());
+
+string listAllFiles(const ListOptions &opts = ListOptions());
+
+string relativeDir(const Session &s);
+
+bool resolveInHome(const Session &s, const string &name, string &out);
+
+void refreshHome(Session &s);
+
+string resolveUserPath(const string &userPath, string &user);
+
+string makeDirectory(const Session &s, const string &dirname);
+
+string deleteFile(const Session &s, const string &filename);
+
+string changeDirectory(Session &s, const string &dirname);
+
+// COPY/MOVE, "" on success like MKDIR/DELETE. A COPY source starting with '/'
+// is "/user/path" in any home (as GETALL reads it); everything else is
+// resolved in the own home. A target that is a directory gets the source name.
+string copyFile(const Session &s, const string &src, const string &dst);
+
+string moveFile(const Session &s, const string &src, const string &dst);
+
+string usageReport(const string &user);
+
+class Watch;
+
+string watchRoot(const Session &s, const string &dir, string &root);
+
+// WATCH mode: push event batches until UNWATCH ("OK\nStopped watching\n").
+//   EVENTS <n>\n + n lines "<C|D> <user/path>"  C = created or changed, D = removed;
+//                                               directories end in '/'
+//   RESYNC\n                                   events were dropped, re-list the subtree
+// Returns false when the session is over (EXIT, connection gone).
+bool watchLoop(int clientSock, Watch &w);
+
 void handleClient(int clientSock);
 
+void handleClientV2(int clientSock, Session &session);
+
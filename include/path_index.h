@@ -0,0 +1,55 @@
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum class FindMode { Substring, Prefix, Glob };
+
+struct FindQuery {
+    FindMode mode = FindMode::Substring;
+    string pattern;
+    uint64_t minSize = 0;
+    uint64_t maxSize = UINT64_MAX;
+    time_t newerThan = 0;  // mtime strictly after, 0 = any
+    time_t olderThan = 0;  // mtime strictly before, 0 = any
+    bool filesOnly = false;
+    size_t offset = 0;
+    size_t limit = 100;
+};
+
+struct IndexEntry {
+    uint64_t size = 0;
+    time_t mtime = 0;
+    bool isDir = false;
+};
+
+// sorted in-memory index of every path in every home, keyed "user/dir/file".
+// Built once at startup and kept current by the server's mutating commands,
+// so FIND never touches the filesystem.
+class PathIndex {
+public:
+    void scan(const map<string, string> &homes); // user -> home directory
+
+    // key = "user/" + path relative to the home; stats the path and inserts or drops it
+    void refresh(const string &key, const string &fullPath);
+    void removeTree(const string &key);
+
+    // matches in key order, paged; total = all matches
+    vector<pair<string, IndexEntry>> find(const FindQuery &q, size_t &total);
+    size_t size();
+
+private:
+    shared_mutex mtx;
+    map<string, IndexEntry> entries;
+};
+
+extern PathIndex pathIndex;
+
+#endif
\ No newline at end of file
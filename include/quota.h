@@ -0,0 +1,50 @@
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+struct UserUsage {
+    uint64_t bytes = 0;
+    uint64_t files = 0;
+    uint64_t dirs = 0;
+    uint64_t reserved = 0; // announced by uploads still in flight
+};
+
+// per-user storage ledger: built by one scan at startup, then kept current by
+// PUT/DELETE/MKDIR so quota checks and USAGE never walk a tree
+class UsageLedger {
+public:
+    void scan(const map<string, string> &homes); // user -> home directory
+    void setDefaultQuota(uint64_t bytes) { defaultQuota = bytes; }
+    void loadQuotaFile(const string &path); // lines "<username> <megabytes>"
+
+    // called when an upload announces its size; false = it would go over quota.
+    // replacedBytes is the size of the file it overwrites (not counted twice).
+    bool reserve(const string &user, uint64_t fsize, uint64_t replacedBytes, uint64_t &reserved);
+    void release(const string &user, uint64_t reserved);
+
+    void fileStored(const string &user, uint64_t newSize, int64_t replacedSize); // replacedSize -1 = new file
+    void fileRemoved(const string &user, uint64_t size);
+    void dirCreated(const string &user);
+
+    UserUsage usage(const string &user);
+    uint64_t quota(const string &user); // 0 = unlimited
+
+private:
+    uint64_t quotaLocked(const string &user) const;
+
+    mutex mtx;
+    unordered_map<string, UserUsage> users;
+    unordered_map<string, uint64_t> quotas;
+    uint64_t defaultQuota = 0;
+};
+
+extern UsageLedger usageLedger;
+
+#endif
\ No newline at end of file
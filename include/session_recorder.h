@@ -0,0 +1,65 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+// lines are collected up to this size, then appended with a single write()
+#define RECORD_FLUSH_BYTES (64 * 1024)
+
+// opt-in capture of what clients do, for bin/ftp_replay. One line per command:
+//   <session> <start_us> <dur_us> <bytes_in> <bytes_out> <VERB>[ <args>]
+// start_us is wall clock (so files appended across restarts stay ordered),
+// dur_us is the time until the reply was out, the byte counts are file payload
+// only (PUT/GET data). v2 frames are written with the same verbs as the text
+// protocol; passwords are never written. A session ends with an END line.
+class SessionRecorder {
+public:
+    bool start(const string &path);
+    void stop();
+    bool enabled() const { return on.load(memory_order_relaxed); }
+    uint64_t newSession();
+    void endSession(uint64_t session);
+    void record(uint64_t session, int64_t startUs, int64_t durUs, uint64_t bytesIn, uint64_t bytesOut,
+                const string &verb, const string &args);
+
+private:
+    atomic<bool> on{false};
+    atomic<uint64_t> nextSession{0};
+    uint64_t sessionBase = 0;
+    void flushLocked();
+
+    mutex mtx;
+    int fd = -1;
+    string pending; // whole lines only, written out together
+};
+
+extern SessionRecorder recorder;
+
+int64_t recordClock();
+
+// one command from parse to reply; writes its line when it goes away.
+// A no-op when recording is off or session is 0. v2 workers keep it in a
+// shared_ptr so the line is written when the reply is out.
+class RecordCommand {
+public:
+    RecordCommand(uint64_t session, const string &verb, const string &args);
+    ~RecordCommand() { end(); }
+    void addBytes(uint64_t in, uint64_t out);
+    void end();
+    RecordCommand(const RecordCommand &) = delete;
+    RecordCommand &operator=(const RecordCommand &) = delete;
+
+private:
+    uint64_t session;
+    string verb, args;
+    int64_t start = 0;
+    uint64_t bytesIn = 0, bytesOut = 0;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef SESSION_REGISTRY_H
+#define SESSION_REGISTRY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+// one live client connection as the reaper sees it
+struct SessionSlot {
+    int sock = -1;
+    atomic<int64_t> lastActive{0}; // steady clock ms of the last byte moved
+    atomic<int> busy{0};           // >0 while a command or a v2 worker is running
+    atomic<bool> reaped{false};
+};
+
+// every handleClient registers here. The reaper shuts down sockets that sat
+// idle between commands (idle timeout) or made no progress inside a command
+// (stall timeout); the blocked session thread then fails its recv and exits.
+class SessionRegistry {
+public:
+    shared_ptr<SessionSlot> add(int sock);
+    void remove(const shared_ptr<SessionSlot> &slot);
+
+    void startReaper(int idleSec, int stallSec); // 0 disables the timeout
+    void stopReaper();
+
+    size_t active();
+    string stats();
+
+    // graceful shutdown: sessions waiting for a command are closed right away,
+    // the others as soon as their command finishes; at the deadline the rest
+    // are cut. Returns the number of sessions still open at the end.
+    size_t drain(int timeoutSec);
+    bool draining() const { return drainFlag.load(); }
+
+private:
+    void reapLoop();
+
+    mutex mtx;
+    condition_variable cv;
+    unordered_map<SessionSlot *, shared_ptr<SessionSlot>> slots;
+    thread reaper;
+    bool stopping = false;
+    int64_t idleMs = 0;
+    int64_t stallMs = 0;
+    atomic<uint64_t> accepted{0};
+    atomic<uint64_t> reapedIdle{0};
+    atomic<uint64_t> reapedStall{0};
+    atomic<bool> drainFlag{false};
+};
+
+extern SessionRegistry sessionRegistry;
+
+// the session served by the calling thread; v2 workers bind their parent's slot
+void bindSessionSlot(const shared_ptr<SessionSlot> &slot);
+shared_ptr<SessionSlot> currentSessionSlot();
+
+// stamp progress on the calling thread's session (called by the socket helpers)
+void sessionActivity();
+
+// marks the calling thread's session as inside a command for its lifetime
+class SessionBusy {
+public:
+    SessionBusy();
+    ~SessionBusy();
+    void release();
+    SessionBusy(const SessionBusy &) = delete;
+    SessionBusy &operator=(const SessionBusy &) = delete;
+
+private:
+    SessionSlot *slot;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef SPARSE_MAP_H
+#define SPARSE_MAP_H
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Sparse transfers (GETSPARSE/PUTSPARSE), shared by server and client.
+//
+// The sender describes the file by its data extents and sends only those:
+//   <size> <count>\n          logical file size, number of extents
+//   <offset> <length>\n       count times, ascending and not overlapping
+//   <data>                    the bytes of every extent, in map order
+// Holes are never read or sent. The receiver sizes the file with ftruncate
+// and writes each extent at its offset, so the holes stay holes on its side.
+
+// a larger map is coalesced: small holes between extents travel as zeros
+#define SPARSE_MAX_EXTENTS (1u << 16)
+
+struct Extent {
+    uint64_t offset;
+    uint64_t length;
+};
+
+// data extents of fd up to size, per SEEK_DATA/SEEK_HOLE. A filesystem
+// without hole support reports the whole file as one extent.
+inline vector<Extent> dataExtents(int fd, uint64_t size) {
+    vector<Extent> out;
+    uint64_t pos = 0;
+    while (pos < size) {
+        off_t data = lseek(fd, (off_t)pos, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) break; // only a hole left
+            out.clear();
+            out.push_back({0, size});
+            return out;
+        }
+        if ((uint64_t)data >= size) break;
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        uint64_t end = hole < 0 || (uint64_t)hole > size ? size : (uint64_t)hole;
+        out.push_back({(uint64_t)data, end - (uint64_t)data});
+        pos = end;
+    }
+    // badly fragmented: merge neighbours pairwise until the map fits
+    while (out.size() > SPARSE_MAX_EXTENTS) {
+        size_t n = 0;
+        for (size_t i = 0; i < out.size(); i += 2, ++n) {
+            out[n] = out[i];
+            if (i + 1 < out.size()) out[n].length = out[i + 1].offset + out[i + 1].length - out[i].offset;
+        }
+        out.resize(n);
+    }
+    return out;
+}
+
+inline uint64_t extentBytes(const vector<Extent> &extents) {
+    uint64_t total = 0;
+    for (const Extent &e : extents) total += e.length;
+    return total;
+}
+
+inline string extentMap(uint64_t size, const vector<Extent> &extents) {
+    string map = to_string((unsigned long long)size) + " " + to_string(extents.size()) + "\n";
+    for (const Extent &e : extents) {
+        map += to_string((unsigned long long)e.offset) + " " + to_string((unsigned long long)e.length) + "\n";
+    }
+    return map;
+}
+
+// "<a> <b>" with two plain decimal numbers
+inline bool parseNumberPair(const string &line, uint64_t &a, uint64_t &b) {
+    const char *p = line.c_str();
+    char *end;
+    if (*p < '0' || *p > '9') return false;
+    errno = 0;
+    a = strtoull(p, &end, 10);
+    if (*end != ' ' || end[1] < '0' || end[1] > '9') return false;
+    b = strtoull(end + 1, &end, 10);
+    return *end == '\0' && errno == 0;
+}
+
+// one map line; extents must come in order, must not be empty and must end
+// within size. end is where the previous extent stopped (0 before the first).
+inline bool parseExtent(const string &line, uint64_t size, uint64_t &end, Extent &e) {
+    if (!parseNumberPair(line, e.offset, e.length)) return false;
+    if (e.length == 0 || e.offset < end || e.offset > size || e.length > size - e.offset) return false;
+    end = e.offset + e.length;
+    return true;
+}
+
+#endif
\ No newline at end of file
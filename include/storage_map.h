@@ -0,0 +1,68 @@
+#ifndef STORAGE_MAP_H
+#define STORAGE_MAP_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+struct StorageRoot {
+    string path;          // normalized, ends with '/'
+    unsigned weight = 1;  // share of the hash ring
+};
+
+// held by every command touching a user's files; migration takes it exclusively
+typedef shared_ptr<shared_lock<shared_mutex>> UserHold;
+
+// which storage root each user's home lives on. server/storage.conf lists
+//     root <dir> [weight]
+//     pin <user> <dir>
+// New users land on the root a consistent-hash ring picks for their name.
+// Where every user actually is goes to server/placement.txt, so adding a root
+// never hides existing homes. rebalance() (SIGUSR1) moves the users whose pin
+// or ring position changed, online.
+class StorageMap {
+public:
+    // no config file: one root, defaultRoot, exactly the old single-tree layout
+    void load(const string &confFile, const string &placementFile, const string &defaultRoot);
+
+    string homeOf(const string &user);        // "<root><user>", no trailing slash
+    string placeNewUser(const string &user);  // records the ring's pick for a new account
+    map<string, string> homes();              // user -> home for every placed user
+    bool keyOf(const string &path, string &key); // "user/rel" for a path inside any root
+
+    UserHold holdUser(const string &user);
+
+    // copy the home to root (rename when on the same filesystem), switch the
+    // placement under the user's exclusive lock, then drop the old copy
+    bool migrate(const string &user, const string &root, string &err);
+    void rebalance(); // reload storage.conf and migrate users whose target changed
+    string stats();
+
+private:
+    void loadConf();
+    string ringRoot(const string &user); // mtx held
+    void savePlacement();                 // mtx held
+    shared_ptr<shared_mutex> userLock(const string &user);
+
+    mutex mtx;
+    vector<StorageRoot> roots;
+    map<uint64_t, string> ring;              // point -> root
+    unordered_map<string, string> pins;      // user -> root
+    unordered_map<string, string> placement; // user -> root
+    unordered_map<string, shared_ptr<shared_mutex>> userLocks;
+    string confPath, placementPath, fallbackRoot;
+    atomic<bool> rebalancing{false};
+    atomic<uint64_t> migrated{0};
+};
+
+extern StorageMap storageMap;
+
+#endif
\ No newline at end of file
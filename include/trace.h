@@ -0,0 +1,112 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct TraceEvent {
+    string name;
+    const char *cat;
+    int64_t ts;     // microseconds since the tracer started
+    int64_t dur;
+    uint64_t bytes; // 0 = not shown
+    string detail;  // command line or path, may be empty
+};
+
+struct TraceBuffer {
+    mutex mtx; // only contended while the flusher swaps it out
+    vector<TraceEvent> events;
+    int tid = 0;
+};
+
+// opt-in span tracing. Each thread appends complete events to its own buffer;
+// a flusher thread writes them once a second as Chrome trace event JSON
+// (chrome://tracing, ui.perfetto.dev). Only a sampled fraction of commands
+// records anything, the rest pay one thread-local flag check per span.
+class Tracer {
+public:
+    bool start(const string &path, double sampleRate);
+    void stop(); // final flush; the file is a complete JSON array afterwards
+    bool enabled() const { return on.load(memory_order_relaxed); }
+    bool sample();
+    void record(TraceEvent &&e);
+    int64_t now() const;
+
+private:
+    void flushLoop();
+    void flushAll();
+    TraceBuffer &threadBuffer();
+
+    atomic<bool> on{false};
+    atomic<bool> stopping{false};
+    double rate = 1.0;
+    FILE *out = nullptr;
+    bool first = true;
+    int pid = 0;
+    int64_t origin = 0;
+    mutex bufsMtx;
+    vector<shared_ptr<TraceBuffer>> buffers;
+    thread flusher;
+};
+
+extern Tracer tracer;
+
+// whether the command running on this thread is being traced; worker threads
+// started for a command copy it with TraceInherit
+bool traceSampled();
+
+class TraceInherit {
+public:
+    explicit TraceInherit(bool sampled);
+    ~TraceInherit();
+
+private:
+    bool saved;
+};
+
+// one timed phase (open, stat, read, send, write, fsync, ...) of a traced command
+class TraceSpan {
+public:
+    TraceSpan(const char *name, const char *cat = "io", uint64_t bytes = 0);
+    ~TraceSpan() { end(); }
+    void setBytes(uint64_t b) { bytes = b; }
+    void setDetail(const string &d) {
+        if (active) detail = d;
+    }
+    void end();
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    bool active;
+    string name; // only filled when active
+    const char *cat;
+    int64_t start = 0;
+    uint64_t bytes;
+    string detail;
+};
+
+// root span of a command: makes the sampling decision for this thread
+class TraceCommand {
+public:
+    TraceCommand(const char *name, const string &detail);
+    ~TraceCommand() { end(); }
+    void end();
+    TraceCommand(const TraceCommand &) = delete;
+    TraceCommand &operator=(const TraceCommand &) = delete;
+
+private:
+    TraceInherit scope;
+    TraceSpan span;
+    bool ended = false;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef UPLOAD_VERSIONS_H
+#define UPLOAD_VERSIONS_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+#define UPLOAD_VERSION_STRIPES 64
+
+// orders concurrent uploads of one path. Each upload writes its own temp file
+// and claims a version (a global counter, so later starts get higher numbers).
+// At commit, only an upload that is still the newest one for its path may
+// rename over the file; an older upload finishing late is dropped instead of
+// putting stale data back. The stripe lock covers only the check, the rename
+// and the ledger update, never any data I/O. Readers are not involved: a GET
+// holds an open fd on the version it started with.
+class UploadVersions {
+public:
+    uint64_t claim(const string &path);
+
+    // the claimed upload is complete: publish (stat + rename) runs under the
+    // path's stripe lock unless a newer version already committed, in which
+    // case it returns false and publish is not called. Ends the claim.
+    bool finish(const string &path, uint64_t version, const function<void()> &publish);
+
+    // the claimed upload failed or was aborted
+    void abandon(const string &path);
+
+    string stats();
+
+private:
+    struct PathState {
+        uint64_t committed = 0; // newest version renamed into place so far
+        size_t inFlight = 0;    // the entry goes away with the last claim
+    };
+    struct Stripe {
+        mutex mtx;
+        unordered_map<string, PathState> paths;
+    };
+
+    Stripe &stripeOf(const string &key);
+    void release(Stripe &s, unordered_map<string, PathState>::iterator it);
+
+    Stripe stripes[UPLOAD_VERSION_STRIPES];
+    atomic<uint64_t> nextVersion{0};
+    atomic<uint64_t> superseded{0};
+};
+
+extern UploadVersions uploadVersions;
+
+#endif
\ No newline at end of file
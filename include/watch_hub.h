@@ -0,0 +1,69 @@
+#ifndef WATCH_HUB_H
+#define WATCH_HUB_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// one WATCH subscription. Events on the same path coalesce (the last kind
+// wins) until the session takes them; when more than maxPending paths pile
+// up the backlog is dropped and the subscriber is told to resync instead.
+class Watch {
+public:
+    Watch(const string &root, size_t maxPending);
+    ~Watch();
+    Watch(const Watch &) = delete;
+    Watch &operator=(const Watch &) = delete;
+
+    const string root; // key of the watched directory ("user/dir"), "" = every home
+    int fd() const { return efd; } // eventfd, readable while something is pending
+
+    // move the pending events out; resync = some were dropped since the last take
+    void take(map<string, char> &events, bool &resync);
+
+private:
+    friend class WatchHub;
+    bool add(const string &key, char kind); // false = this add overflowed
+
+    mutex mtx;
+    map<string, char> pending;
+    bool overflow = false;
+    size_t maxPending;
+    int efd;
+};
+
+// fans the server's own change notifications (fileChanged/dirChanged) out to
+// the WATCH subscriptions whose subtree they touch. Subscriptions are kept per
+// user, so a change only visits the watchers of its own home (and the global ones).
+class WatchHub {
+public:
+    void setMaxPending(size_t n) { maxPending = n; }
+    bool active() const { return watchers.load(memory_order_relaxed) > 0; }
+
+    shared_ptr<Watch> subscribe(const string &root);
+    void unsubscribe(const shared_ptr<Watch> &w);
+
+    // key "user/path", directories end in '/'; kind 'C' = created or changed, 'D' = removed
+    void publish(const string &key, char kind);
+
+    string stats();
+
+private:
+    mutex mtx;
+    unordered_map<string, vector<shared_ptr<Watch>>> byUser; // "" = watchers of every home
+    size_t maxPending = 1024;
+    atomic<size_t> watchers{0};
+    atomic<uint64_t> published{0};
+    atomic<uint64_t> resyncs{0};
+};
+
+extern WatchHub watchHub;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include "auth.h"
+#include "picosha2.h"
+#include <cstring>
+
+AuthPool authPool;
+
+static const char PBKDF2_TAG[] = "pbkdf2:";
+
+bool parsePasswordEntry(const string &saltField, const string &hash, PasswordEntry &e) {
+    e.hash = hash;
+    if (saltField.rfind(PBKDF2_TAG, 0) != 0) {
+        e.salt = saltField;
+        e.iterations = 0;
+        return true;
+    }
+    size_t colon = saltField.find(':', sizeof(PBKDF2_TAG) - 1);
+    if (colon == string::npos) return false;
+    try {
+        e.iterations = stoi(saltField.substr(sizeof(PBKDF2_TAG) - 1, colon - (sizeof(PBKDF2_TAG) - 1)));
+    } catch (...) {
+        return false;
+    }
+    e.salt = saltField.substr(colon + 1);
+    return e.iterations > 0;
+}
+
+string saltField(const PasswordEntry &e) {
+    if (e.iterations == 0) return e.salt;
+    return PBKDF2_TAG + to_string(e.iterations) + ":" + e.salt;
+}
+
+// HMAC-SHA256 with the padded key blocks hashed once up front
+struct Hmac {
+    picosha2::hash256_one_by_one inner, outer;
+
+    explicit Hmac(const string &key) {
+        unsigned char k[64] = {0};
+        if (key.size() > 64) picosha2::hash256(key.begin(), key.end(), k, k + 32);
+        else memcpy(k, key.data(), key.size());
+        unsigned char ipad[64], opad[64];
+        for (int i = 0; i < 64; ++i) {
+            ipad[i] = k[i] ^ 0x36;
+            opad[i] = k[i] ^ 0x5c;
+        }
+        inner.process(ipad, ipad + 64);
+        outer.process(opad, opad + 64);
+    }
+
+    void mac(const unsigned char *msg, size_t len, unsigned char out[32]) const {
+        picosha2::hash256_one_by_one h = inner;
+        h.process(msg, msg + len);
+        h.finish();
+        unsigned char ih[32];
+        h.get_hash_bytes(ih, ih + 32);
+        picosha2::hash256_one_by_one o = outer;
+        o.process(ih, ih + 32);
+        o.finish();
+        o.get_hash_bytes(out, out + 32);
+    }
+};
+
+// PBKDF2-HMAC-SHA256, one 32 byte block
+static string pbkdf2Hex(const string &password, const string &salt, int iterations) {
+    Hmac prf(password);
+    vector<unsigned char> first(salt.begin(), salt.end());
+    first.insert(first.end(), {0, 0, 0, 1});
+    unsigned char u[32], t[32];
+    prf.mac(first.data(), first.size(), u);
+    memcpy(t, u, sizeof(t));
+    for (int i = 1; i < iterations; ++i) {
+        prf.mac(u, sizeof(u), u);
+        for (int j = 0; j < 32; ++j) t[j] ^= u[j];
+    }
+    string hex;
+    picosha2::bytes_to_hex_string(t, t + 32, hex);
+    return hex;
+}
+
+void hashPassword(const string &password, PasswordEntry &e) {
+    if (e.iterations == 0) e.hash = picosha2::hash256_hex_string(password + e.salt);
+    else e.hash = pbkdf2Hex(password, e.salt, e.iterations);
+}
+
+bool verifyPassword(const string &password, const PasswordEntry &e) {
+    PasswordEntry attempt = e;
+    hashPassword(password, attempt);
+    if (attempt.hash.size() != e.hash.size()) return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < e.hash.size(); ++i) diff |= (unsigned char)(attempt.hash[i] ^ e.hash[i]);
+    return diff == 0;
+}
+
+void AuthPool::start(int threads, size_t maxQueued) {
+    this->maxQueued = maxQueued;
+    for (int i = 0; i < threads; ++i) workers.emplace_back(&AuthPool::workLoop, this);
+    lock_guard<mutex> lock(mtx);
+    this->threads = workers.size();
+    running = !workers.empty();
+}
+
+void AuthPool::stop() {
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+        running = false;
+    }
+    workCv.notify_all();
+    spaceCv.notify_all();
+    for (auto &t : workers) t.join();
+    workers.clear();
+    lock_guard<mutex> lock(mtx);
+    threads = 0;
+}
+
+bool AuthPool::run(const function<bool()> &fn) {
+    unique_lock<mutex> lock(mtx);
+    if (!running) {
+        lock.unlock();
+        return fn();
+    }
+    Job job;
+    job.fn = fn;
+    if (queue.size() >= maxQueued) {
+        ++waitedForSpace;
+        spaceCv.wait(lock, [this] { return queue.size() < maxQueued || stopping; });
+    }
+    if (stopping) {
+        lock.unlock();
+        return fn();
+    }
+    queue.push_back(&job);
+    workCv.notify_one();
+    job.doneCv.wait(lock, [&job] { return job.done; });
+    return job.result;
+}
+
+void AuthPool::workLoop() {
+    unique_lock<mutex> lock(mtx);
+    while (true) {
+        workCv.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) return; // stopping, and nothing left for waiting callers
+        Job *job = queue.front();
+        queue.pop_front();
+        spaceCv.notify_one();
+        lock.unlock();
+        bool result = job->fn();
+        lock.lock();
+        job->result = result;
+        job->done = true;
+        ++completed;
+        // still under the lock: the caller cannot return and destroy the job before this
+        job->doneCv.notify_one();
+    }
+}
+
+string AuthPool::stats() {
+    size_t queued, nthreads;
+    {
+        lock_guard<mutex> lock(mtx);
+        queued = queue.size();
+        nthreads = threads;
+    }
+    return "auth_threads " + to_string(nthreads) + "\n" + "auth_queued " + to_string(queued) + "\n" +
+           "auth_completed " + to_string(completed.load()) + "\n" + "auth_queue_full_waits " +
+           to_string(waitedForSpace.load()) + "\n";
+}
\ No newline at end of file
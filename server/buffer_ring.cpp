@@ -0,0 +1,71 @@
+#include "buffer_ring.h"
+#include <cstdlib>
+
+BufferRing::BufferRing(size_t count, size_t size, size_t align) : size(size) {
+    for (size_t i = 0; i < count; ++i) {
+        Slot s;
+        s.data = (char *)aligned_alloc(align, size);
+        if (!s.data) break;
+        slots.push_back(s);
+    }
+    if (slots.size() < count) {
+        for (auto &s : slots) free(s.data);
+        slots.clear();
+    }
+    for (auto &s : slots) freeSlots.push_back(&s);
+}
+
+BufferRing::~BufferRing() {
+    for (auto &s : slots) free(s.data);
+}
+
+BufferRing::Slot *BufferRing::acquire() {
+    unique_lock<mutex> lock(mtx);
+    cv.wait(lock, [this] { return cancelled || !freeSlots.empty(); });
+    if (cancelled) return nullptr;
+    Slot *s = freeSlots.front();
+    freeSlots.pop_front();
+    s->len = 0;
+    return s;
+}
+
+void BufferRing::push(Slot *s) {
+    {
+        lock_guard<mutex> lock(mtx);
+        filled.push_back(s);
+    }
+    cv.notify_all();
+}
+
+void BufferRing::finish() {
+    {
+        lock_guard<mutex> lock(mtx);
+        done = true;
+    }
+    cv.notify_all();
+}
+
+BufferRing::Slot *BufferRing::pop() {
+    unique_lock<mutex> lock(mtx);
+    cv.wait(lock, [this] { return cancelled || done || !filled.empty(); });
+    if (cancelled || filled.empty()) return nullptr;
+    Slot *s = filled.front();
+    filled.pop_front();
+    return s;
+}
+
+void BufferRing::release(Slot *s) {
+    {
+        lock_guard<mutex> lock(mtx);
+        freeSlots.push_back(s);
+    }
+    cv.notify_all();
+}
+
+void BufferRing::cancel() {
+    {
+        lock_guard<mutex> lock(mtx);
+        cancelled = true;
+    }
+    cv.notify_all();
+}
\ No newline at end of file
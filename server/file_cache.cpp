@@ -0,0 +1,139 @@
+#include "file_cache.h"
+#include <functional>
+#include <sstream>
+
+FileCache fileCache(64u << 20, 1u << 20);
+
+FileCache::FileCache(size_t capacityBytes, size_t maxEntryBytes)
+    : capacity(capacityBytes), maxEntry(maxEntryBytes) {}
+
+void FileCache::setLimits(size_t capacityBytes, size_t maxEntryBytes) {
+    lock_guard<mutex> lock(mtx);
+    capacity = capacityBytes;
+    maxEntry = maxEntryBytes;
+    while (used > capacity && !lru.empty()) evictOne();
+}
+
+static size_t sketchIndex(size_t h, int row, size_t width) {
+    // derive four indexes from one hash
+    h ^= h >> (7 + row * 8);
+    h *= 0x9E3779B97F4A7C15ull + row * 2;
+    return (h >> 20) % width;
+}
+
+void FileCache::touchFrequency(const string &path) {
+    size_t h = hash<string>()(path);
+    for (int r = 0; r < 4; ++r) {
+        uint8_t &c = sketch[r][sketchIndex(h, r, SKETCH_WIDTH)];
+        if (c < 255) ++c;
+    }
+    if (++samples >= resetInterval) {
+        // aging: old popularity decays so new hot files can get in
+        for (auto &row : sketch)
+            for (auto &c : row) c >>= 1;
+        samples = 0;
+    }
+}
+
+unsigned FileCache::frequency(const string &path) const {
+    size_t h = hash<string>()(path);
+    unsigned f = 255;
+    for (int r = 0; r < 4; ++r) f = min<unsigned>(f, sketch[r][sketchIndex(h, r, SKETCH_WIDTH)]);
+    return f;
+}
+
+void FileCache::evictOne() {
+    const string &victim = lru.back();
+    auto it = entries.find(victim);
+    used -= entryCost(victim, *it->second.data);
+    entries.erase(it);
+    lru.pop_back();
+    ++evictions;
+}
+
+shared_ptr<const string> FileCache::get(const string &path) {
+    lock_guard<mutex> lock(mtx);
+    touchFrequency(path); // also feeds hot() when caching is off
+    if (!enabled()) return nullptr;
+    auto it = entries.find(path);
+    if (it == entries.end()) {
+        ++misses;
+        return nullptr;
+    }
+    lru.splice(lru.begin(), lru, it->second.lruPos);
+    ++hits;
+    return it->second.data;
+}
+
+bool FileCache::hot(const string &path) {
+    lock_guard<mutex> lock(mtx);
+    return frequency(path) >= 2;
+}
+
+void FileCache::put(const string &path, shared_ptr<const string> data, uint64_t token) {
+    lock_guard<mutex> lock(mtx);
+    if (!data || !cacheable(data->size())) return;
+    if (token != epoch.load()) return; // invalidated while the file was being read
+    size_t cost = entryCost(path, *data);
+    if (cost > capacity) return;
+
+    auto it = entries.find(path);
+    if (it != entries.end()) {
+        used -= entryCost(path, *it->second.data);
+        lru.erase(it->second.lruPos);
+        entries.erase(it);
+    }
+
+    // TinyLFU admission: only displace entries that are requested less often
+    unsigned candidateFreq = frequency(path);
+    while (used + cost > capacity && !lru.empty()) {
+        if (frequency(lru.back()) > candidateFreq) {
+            ++rejected;
+            return;
+        }
+        evictOne();
+    }
+
+    lru.push_front(path);
+    entries[path] = Entry{move(data), lru.begin()};
+    used += cost;
+}
+
+void FileCache::invalidate(const string &path) {
+    lock_guard<mutex> lock(mtx);
+    ++epoch;
+    auto it = entries.find(path);
+    if (it == entries.end()) return;
+    used -= entryCost(path, *it->second.data);
+    lru.erase(it->second.lruPos);
+    entries.erase(it);
+}
+
+void FileCache::invalidatePrefix(const string &dirPrefix) {
+    lock_guard<mutex> lock(mtx);
+    ++epoch;
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->first.compare(0, dirPrefix.size(), dirPrefix) == 0) {
+            used -= entryCost(it->first, *it->second.data);
+            lru.erase(it->second.lruPos);
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+string FileCache::stats() {
+    lock_guard<mutex> lock(mtx);
+    uint64_t total = hits + misses;
+    ostringstream ss;
+    ss << "cache_entries " << entries.size() << "\n"
+       << "cache_bytes " << used << "\n"
+       << "cache_capacity_bytes " << capacity << "\n"
+       << "cache_hits " << hits << "\n"
+       << "cache_misses " << misses << "\n"
+       << "cache_hit_rate " << (total ? (double)hits / total : 0.0) << "\n"
+       << "cache_evictions " << evictions << "\n"
+       << "cache_rejected " << rejected << "\n";
+    return ss.str();
+}
\ No newline at end of file
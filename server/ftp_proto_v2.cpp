@@ -0,0 +1,381 @@
+#include "ftp_server.h"
+#include "ftp_proto.h"
+#include "file_cache.h"
+#include "session_registry.h"
+#include "storage_map.h"
+#include "trace.h"
+#include "session_recorder.h"
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+// requests of one v2 session that may run at the same time; beyond this
+// they run on the reader thread, which also throttles the client
+#define V2_MAX_WORKERS 8
+
+struct V2Conn {
+    int sock;
+    mutex sendMutex;
+    mutex workMutex;
+    condition_variable workCv;
+    int workers = 0;
+
+    // header and payload go out under one lock so frames of different streams never mix
+    bool sendFrame(uint8_t opcode, uint16_t flags, uint32_t id, const char *data, size_t len) {
+        char hdr[FRAME_HEADER_SIZE];
+        FrameHeader h;
+        h.length = (uint32_t)len;
+        h.opcode = opcode;
+        h.flags = flags;
+        h.requestId = id;
+        encodeFrameHeader(hdr, h);
+        // header and payload in one writev: no header-only segment, no copy
+        lock_guard<mutex> lock(sendMutex);
+        return send_allv(sock, hdr, sizeof(hdr), data, len);
+    }
+
+    bool reply(uint32_t id, const string &text) {
+        return sendFrame(OP_REPLY, FRAME_END, id, text.data(), text.size());
+    }
+
+    bool error(uint32_t id, const string &msg) {
+        return sendFrame(OP_REPLY, FRAME_END | FRAME_ERROR, id, msg.data(), msg.size());
+    }
+};
+
+struct V2Upload {
+    UploadFile up;
+    string savePath;
+    uint64_t size = 0;
+    uint64_t received = 0;
+    bool failed = false; // write error: swallow DATA until FRAME_END
+    UserHold hold;       // the home cannot migrate until the upload is committed
+    shared_ptr<RecordCommand> rec;
+};
+
+// span names for traces
+static const char *opcodeName(uint8_t op) {
+    switch (op) {
+    case OP_LOGIN: return "LOGIN";
+    case OP_REGISTER: return "REGISTER";
+    case OP_LIST: return "LIST";
+    case OP_LISTALL: return "LISTALL";
+    case OP_PWD: return "PWD";
+    case OP_CD: return "CD";
+    case OP_MKDIR: return "MKDIR";
+    case OP_DELETE: return "DELETE";
+    case OP_GET: return "GET";
+    case OP_GETALL: return "GETALL";
+    case OP_PUT: return "PUT";
+    case OP_STATS: return "STATS";
+    case OP_HELP: return "HELP";
+    case OP_USAGE: return "USAGE";
+    case OP_FIND: return "FIND";
+    case OP_COPY: return "COPY";
+    case OP_MOVE: return "MOVE";
+    case OP_DATA: return "DATA";
+    default: return "UNKNOWN";
+    }
+}
+
+// text-protocol form of a frame's arguments for the recording ("<size> <name>" -> "<name>")
+static string recordArgs(uint8_t op, const string &args) {
+    if (op != OP_PUT) return args;
+    size_t sp = args.find(' ');
+    return sp == string::npos ? "" : args.substr(sp + 1);
+}
+
+// run fn on its own thread if the session has a free worker slot
+static void runAsync(V2Conn &c, function<void()> fn) {
+    {
+        lock_guard<mutex> lock(c.workMutex);
+        if (c.workers >= V2_MAX_WORKERS) {
+            fn();
+            return;
+        }
+        ++c.workers;
+    }
+    shared_ptr<SessionSlot> slot = currentSessionSlot();
+    bool traced = traceSampled();
+    thread([&c, fn, slot, traced]() {
+        bindSessionSlot(slot);
+        {
+            SessionBusy busy;
+            TraceInherit trace(traced);
+            fn();
+        }
+        lock_guard<mutex> lock(c.workMutex);
+        if (--c.workers == 0) c.workCv.notify_all();
+    }).detach();
+}
+
+// OP_REPLY with the size, then OP_DATA chunks; the last one carries FRAME_END.
+// Returns the file bytes sent.
+static uint64_t streamFile(V2Conn &c, uint32_t id, const string &path) {
+    bool exists = false;
+    uint64_t fsize = 0;
+    uint64_t maxInMemory = fileCache.enabled() ? serverConfig.cacheMaxFileBytes : 0;
+    int fd = -1;
+    shared_ptr<const string> data = loadSmallFile(path, maxInMemory, exists, fsize, &fd);
+    if (!exists) {
+        c.error(id, "File not found");
+        return 0;
+    }
+    if (data) {
+        string sizeText = to_string(data->size());
+        if (!c.sendFrame(OP_REPLY, 0, id, sizeText.data(), sizeText.size())) return 0;
+        size_t off = 0;
+        do {
+            size_t n = min<size_t>(FRAME_DATA_CHUNK, data->size() - off);
+            uint16_t flags = off + n == data->size() ? FRAME_END : 0;
+            if (!c.sendFrame(OP_DATA, flags, id, data->data() + off, n)) return 0;
+            off += n;
+        } while (off < data->size());
+        return data->size();
+    }
+
+    // the fd loadSmallFile opened: this version, whatever uploads commit meanwhile
+    string sizeText = to_string(fsize);
+    if (!c.sendFrame(OP_REPLY, 0, id, sizeText.data(), sizeText.size()) || fsize == 0) {
+        if (fsize == 0) c.sendFrame(OP_DATA, FRAME_END, id, nullptr, 0);
+        close(fd);
+        return 0;
+    }
+    uint64_t left = fsize;
+    bool ok = streamFromDisk(fd, fsize, path, [&c, id, &left](const char *p, size_t n) {
+        left -= n;
+        return c.sendFrame(OP_DATA, left == 0 ? FRAME_END : 0, id, p, n);
+    });
+    close(fd);
+    return ok ? fsize : 0;
+}
+
+static void finishUpload(V2Conn &c, uint32_t id, V2Upload &u, const string &username) {
+    if (u.failed) {
+        abortUpload(u.up);
+        return; // error already reported
+    }
+    if (u.received != u.size) {
+        abortUpload(u.up);
+        c.error(id, "Size mismatch");
+        return;
+    }
+    if (!commitUpload(u.up, u.size)) {
+        c.error(id, "Cannot save file");
+        return;
+    }
+    fileChanged(u.savePath);
+    if (u.rec) u.rec->addBytes(u.size, 0);
+    cout << "[LOG] PUT saved (v2, " << username << "): " << u.savePath << " (" << u.size << " bytes)\n";
+    c.reply(id, "OK");
+}
+
+void handleClientV2(int clientSock, Session &session) {
+    V2Conn c;
+    c.sock = clientSock;
+    map<uint32_t, V2Upload> uploads;
+    vector<char> payload;
+
+    while (true) {
+        char hdr[FRAME_HEADER_SIZE];
+        {
+            // waiting for the rest of an upload is a transfer, not an idle session
+            unique_ptr<SessionBusy> midUpload;
+            if (!uploads.empty()) midUpload.reset(new SessionBusy);
+            if (recv_exact(clientSock, hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) break;
+        }
+        FrameHeader h;
+        if (!decodeFrameHeader(hdr, h)) {
+            c.error(h.requestId, "Bad frame");
+            break; // cannot resync the stream
+        }
+        payload.resize(h.length);
+        if (h.length > 0 && recv_exact(clientSock, payload.data(), h.length) != (ssize_t)h.length) break;
+        uint32_t id = h.requestId;
+        SessionBusy busy;
+        bool secret = h.opcode == OP_LOGIN || h.opcode == OP_REGISTER;
+        TraceCommand traceCmd(opcodeName(h.opcode), secret || h.opcode == OP_DATA ? "" : string(payload.begin(), payload.end()));
+
+        if (h.opcode == OP_DATA) {
+            auto it = uploads.find(id);
+            if (it == uploads.end()) continue; // stream already failed and finished
+            V2Upload &u = it->second;
+            if (h.flags & FRAME_ERROR) {
+                // the client gave up on it (its source came up short)
+                abortUpload(u.up);
+                if (!u.failed) c.error(id, "Upload aborted by client: " + string(payload.begin(), payload.end()));
+                cout << "[LOG] PUT aborted by client (v2, " << session.username << "): " << u.savePath << "\n";
+                uploads.erase(it);
+                continue;
+            }
+            if (!u.failed) {
+                TraceSpan span("write", "io", h.length);
+                if (u.received + h.length > u.size || !write_all(u.up.fd, payload.data(), h.length)) {
+                    u.failed = true;
+                    c.error(id, "Write failed");
+                }
+            }
+            u.received += h.length;
+            if (h.flags & FRAME_END) {
+                finishUpload(c, id, u, session.username);
+                uploads.erase(it);
+            }
+            continue;
+        }
+
+        string args(payload.begin(), payload.end());
+        istringstream iss(args);
+        // async replies keep it alive; the line is written once the last one is out
+        shared_ptr<RecordCommand> rec;
+        if (session.recordId) rec = make_shared<RecordCommand>(session.recordId, opcodeName(h.opcode), recordArgs(h.opcode, args));
+
+        if (h.opcode == OP_LOGIN || h.opcode == OP_REGISTER) {
+            string u, p;
+            iss >> u >> p;
+            if (u.empty() || p.empty()) c.error(id, "Wrong format");
+            else if (h.opcode == OP_REGISTER) registerUser(u, p) ? c.reply(id, "REGISTERED") : c.error(id, "User already exists");
+            else loginSession(session, u, p) ? c.reply(id, "LOGGED IN") : c.error(id, "Invalid credentials");
+            continue;
+        }
+        if (h.opcode == OP_HELP) {
+            c.reply(id, helpText());
+            continue;
+        }
+        if (!session.authenticated) {
+            c.error(id, "Not logged in");
+            continue;
+        }
+        // workers keep a copy of the hold until their reply is out
+        UserHold hold = storageMap.holdUser(session.username);
+        refreshHome(session);
+
+        switch (h.opcode) {
+        case OP_LIST:
+        case OP_LISTALL: {
+            ListOptions opts;
+            string err;
+            if (!parseListOptions(args, opts, err)) {
+                c.error(id, err);
+                break;
+            }
+            Session snap = session;
+            bool all = h.opcode == OP_LISTALL;
+            runAsync(c, [&c, id, snap, opts, all, hold, rec]() { c.reply(id, all ? listAllFiles(opts) : listCurrentDir(snap, opts)); });
+            break;
+        }
+        case OP_USAGE:
+            c.reply(id, usageReport(session.username));
+            break;
+        case OP_FIND: {
+            string err;
+            string result = findReport(args, err);
+            err.empty() ? c.reply(id, result) : c.error(id, err);
+            break;
+        }
+        case OP_STATS:
+            c.reply(id, serverStats());
+            break;
+        case OP_PWD:
+            c.reply(id, relativeDir(session));
+            break;
+        case OP_CD:
+        case OP_MKDIR:
+        case OP_DELETE: {
+            string arg;
+            iss >> arg;
+            string err = h.opcode == OP_CD      ? changeDirectory(session, arg)
+                         : h.opcode == OP_MKDIR ? makeDirectory(session, arg)
+                                                : deleteFile(session, arg);
+            err.empty() ? c.reply(id, "OK") : c.error(id, err);
+            break;
+        }
+        case OP_COPY:
+        case OP_MOVE: {
+            string src, dst;
+            iss >> src >> dst;
+            string err = h.opcode == OP_COPY ? copyFile(session, src, dst) : moveFile(session, src, dst);
+            err.empty() ? c.reply(id, "OK") : c.error(id, err);
+            break;
+        }
+        case OP_GET:
+        case OP_GETALL: {
+            string name;
+            iss >> name;
+            if (name.empty()) {
+                c.error(id, "No filename");
+                break;
+            }
+            string path, owner;
+            UserHold ownerHold;
+            if (h.opcode == OP_GET) {
+                path = session.currentPath + "/" + fs::path(name).filename().string();
+            } else if (!resolveUserPath(name, owner).empty()) {
+                if (owner != session.username) ownerHold = storageMap.holdUser(owner);
+                path = resolveUserPath(name, owner);
+            } else {
+                c.error(id, "Bad remote path");
+                break;
+            }
+            cout << "[LOG] GET (v2) request by " << session.username << " for " << path << endl;
+            tuneTransferSocket(clientSock, true);
+            runAsync(c, [&c, id, path, hold, ownerHold, rec]() {
+                uint64_t sent = streamFile(c, id, path);
+                if (rec) rec->addBytes(0, sent);
+            });
+            break;
+        }
+        case OP_PUT: {
+            uint64_t size = 0;
+            string name;
+            iss >> size >> name;
+            if (uploads.count(id)) {
+                // the first upload keeps its temp file, quota and version
+                c.error(id, "Request id already in use");
+                break;
+            }
+            tuneTransferSocket(clientSock, false);
+            V2Upload &u = uploads[id];
+            u.size = size;
+            u.hold = hold;
+            u.rec = rec;
+            string cleanName = fs::path(name).filename().string();
+            string err;
+            if (cleanName.empty()) {
+                err = "No filename";
+            } else {
+                u.savePath = session.currentPath + "/" + cleanName;
+                if (beginUpload(u.up, u.savePath, size, err, session.username) && u.up.direct) {
+                    // frames are not block aligned
+                    fcntl(u.up.fd, F_SETFL, fcntl(u.up.fd, F_GETFL) & ~O_DIRECT);
+                    u.up.direct = false;
+                }
+            }
+            if (!err.empty()) {
+                // rejected before the client sent any data
+                uploads.erase(id);
+                c.error(id, err);
+                break;
+            }
+            c.sendFrame(OP_REPLY, 0, id, "READY", 5);
+            break;
+        }
+        default:
+            c.error(id, "Unknown opcode");
+        }
+    }
+
+    for (auto &kv : uploads) abortUpload(kv.second.up);
+    // workers hold a reference to c; let them finish (sends fail fast once the peer is gone)
+    shutdown(clientSock, SHUT_RD);
+    unique_lock<mutex> lock(c.workMutex);
+    c.workCv.wait(lock, [&c] { return c.workers == 0; });
+}
\ No newline at end of file
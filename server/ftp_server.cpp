@@ -1,13 +1,36 @@
 #include "ftp_server.h"
-#include "picosha2.h"
+#include "file_cache.h"
+#include "ftp_proto.h"
+#include "quota.h"
+#include "path_index.h"
+#include "session_registry.h"
+#include "storage_map.h"
+#include "buffer_ring.h"
+#include "trace.h"
+#include "session_recorder.h"
+#include "auth.h"
+#include "watch_hub.h"
+#include "upload_versions.h"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/fs.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <mutex>
 #include <sstream>
@@ -18,21 +41,59 @@
 const string SERVER_ROOT = "server/";
 const string USERS_FILE = SERVER_ROOT + "users.txt";
 const string BASE_DIR = SERVER_ROOT + "users/"; // users/<username>/
+const string QUOTAS_FILE = SERVER_ROOT + "quotas.txt"; // "<username> <megabytes>" per line
+const string STORAGE_FILE = SERVER_ROOT + "storage.conf"; // storage roots, see storage_map.h
+const string PLACEMENT_FILE = SERVER_ROOT + "placement.txt"; // "<username> <root>", kept by the server
 
 mutex usersMutex;
 
+ServerConfig serverConfig;
+
+// the entry type comes from the readdir d_type cached in directory_entry,
+// so only symlinks (and filesystems without d_type) cost a stat
 void list_directory_recursive(const fs::path& path, const string& prefix, string& result) {
-    for (const auto& entry : fs::directory_iterator(path)) {
+    error_code ec;
+    for (const auto& entry : fs::directory_iterator(path, ec)) {
         string entryName = entry.path().filename().string();
-        if (fs::is_directory(entry.path())) {
+        if (entryName.rfind(UPLOAD_TMP_PREFIX, 0) == 0) continue; // upload in progress
+        if (entry.is_directory(ec)) {
             result += prefix + entryName + "/\n";
             list_directory_recursive(entry.path(), prefix + entryName + "/", result);
-        } else if (fs::is_regular_file(entry.path())) {
+        } else if (entry.is_regular_file(ec)) {
             result += prefix + entryName + "\n";
         }
     }
 }
 
+// one pass over the tree. With withStat every entry costs exactly one statx
+// (type, size and mtime together), otherwise only the cached d_type is used.
+// depth counts the remaining levels: 1 lists path itself, -1 is unlimited.
+void collectListEntries(const fs::path &path, const string &prefix, int depth, bool withStat, vector<ListEntry> &out) {
+    if (depth == 0) return;
+    error_code ec;
+    for (const auto &entry : fs::directory_iterator(path, ec)) {
+        string entryName = entry.path().filename().string();
+        if (entryName.rfind(UPLOAD_TMP_PREFIX, 0) == 0) continue; // upload in progress
+        ListEntry e;
+        if (withStat) {
+            struct statx stx;
+            if (statx(AT_FDCWD, entry.path().c_str(), 0, STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx) != 0) continue;
+            if (S_ISDIR(stx.stx_mode)) e.isDir = true;
+            else if (!S_ISREG(stx.stx_mode)) continue;
+            e.size = e.isDir ? 0 : stx.stx_size;
+            e.mtime = stx.stx_mtime.tv_sec;
+        } else {
+            if (entry.is_directory(ec)) e.isDir = true;
+            else if (!entry.is_regular_file(ec)) continue;
+        }
+        e.name = prefix + entryName + (e.isDir ? "/" : "");
+        bool isDir = e.isDir;
+        string childPrefix = e.name;
+        out.push_back(move(e));
+        if (isDir) collectListEntries(entry.path(), childPrefix, depth < 0 ? -1 : depth - 1, withStat, out);
+    }
+}
+
 string generate_salt(size_t length) {
     const std::string characters = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
     std::random_device random_device;
@@ -58,10 +119,50 @@ bool send_all(int sock, const char *data, size_t len) {
         ssize_t s = send(sock, data + sent, len - sent, 0);
         if (s <= 0) return false;
         sent += s;
+        sessionActivity();
+    }
+    return true;
+}
+
+bool send_allv(int sock, const char *head, size_t headLen, const char *data, size_t len) {
+    struct iovec iov[2] = {{(void *)head, headLen}, {(void *)data, len}};
+    struct iovec *v = iov;
+    int cnt = len > 0 ? 2 : 1;
+    while (cnt > 0) {
+        ssize_t s = writev(sock, v, cnt);
+        if (s < 0 && errno == EINTR) continue;
+        if (s <= 0) return false;
+        sessionActivity();
+        // skip what went out, possibly ending inside an iovec
+        size_t n = (size_t)s;
+        while (cnt > 0 && n >= v->iov_len) {
+            n -= v->iov_len;
+            ++v;
+            --cnt;
+        }
+        if (cnt > 0) {
+            v->iov_base = (char *)v->iov_base + n;
+            v->iov_len -= n;
+        }
     }
     return true;
 }
 
+SocketCork::SocketCork(int sock) : sock(sock) {
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, &one, sizeof(one));
+}
+
+SocketCork::~SocketCork() {
+    int zero = 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+}
+
+void tuneTransferSocket(int sock, bool sending) {
+    int bytes = sending ? serverConfig.sendBufferBytes : serverConfig.recvBufferBytes;
+    if (bytes > 0) setsockopt(sock, SOL_SOCKET, sending ? SO_SNDBUF : SO_RCVBUF, &bytes, sizeof(bytes));
+}
+
 // recv one line (until '\n'); returns empty string on error/close
 string recv_line(int sock) {
     string line;
@@ -72,6 +173,7 @@ string recv_line(int sock) {
         if (c == '\n') break;
         line.push_back(c);
     }
+    sessionActivity();
     return line;
 }
 
@@ -82,100 +184,1392 @@ ssize_t recv_exact(int sock, char *buf, size_t n) {
         ssize_t r = recv(sock, buf + got, n - got, 0);
         if (r <= 0) return r; // error or closed
         got += r;
+        sessionActivity();
+    }
+    return (ssize_t)got;
+}
+
+SockReader::SockReader(int sock, size_t capacity) : sock(sock), buf(capacity) {}
+
+bool SockReader::fill() {
+    pos = 0;
+    len = 0;
+    ssize_t r;
+    do {
+        r = recv(sock, buf.data(), buf.size(), 0);
+    } while (r < 0 && errno == EINTR);
+    if (r <= 0) return false;
+    len = (size_t)r;
+    sessionActivity();
+    return true;
+}
+
+bool SockReader::readLine(string &line) {
+    line.clear();
+    while (true) {
+        if (pos == len && !fill()) return false;
+        const char *start = buf.data() + pos;
+        const char *nl = (const char *)memchr(start, '\n', len - pos);
+        if (nl) {
+            line.append(start, nl - start);
+            pos += (nl - start) + 1;
+            return true;
+        }
+        line.append(start, len - pos);
+        pos = len;
+    }
+}
+
+ssize_t SockReader::readExact(char *dst, size_t n) {
+    size_t got = min(n, len - pos);
+    memcpy(dst, buf.data() + pos, got);
+    pos += got;
+    while (got < n) {
+        if (n - got >= buf.size() / 2) {
+            // big remainder: skip the copy and receive straight into dst
+            ssize_t r = recv_exact(sock, dst + got, n - got);
+            if (r <= 0) return r;
+            return (ssize_t)n;
+        }
+        if (!fill()) return got > 0 ? (ssize_t)got : -1;
+        size_t take = min(n - got, len);
+        memcpy(dst + got, buf.data(), take);
+        pos = take;
+        got += take;
     }
     return (ssize_t)got;
 }
 
-// send "OK\n<size>\n" then send data from file
-void sendFileToClient(int clientSock, const string &filepath) {
-    if (!fs::exists(filepath) || !fs::is_regular_file(filepath)) {
+// write to fd, retrying on short writes
+bool write_all(int fd, const char *data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = write(fd, data + done, len - done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        done += w;
+    }
+    return true;
+}
+
+static bool shouldFsync(uint64_t fsize) {
+    switch (serverConfig.fsync) {
+    case FsyncPolicy::Always: return true;
+    case FsyncPolicy::Large: return fsize >= serverConfig.fsyncMinBytes;
+    default: return false;
+    }
+}
+
+static void fsyncDir(const string &dir) {
+    int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) return;
+    fsync(dfd);
+    close(dfd);
+}
+
+// check the owner's quota, then create the temp file and reserve fsize bytes for it
+bool beginUpload(UploadFile &up, const string &savePath, uint64_t fsize, string &err, const string &user, bool streamed) {
+    fs::path target(savePath);
+    up.user = user;
+    if (!user.empty()) {
+        struct stat st;
+        uint64_t existing = stat(savePath.c_str(), &st) == 0 && S_ISREG(st.st_mode) ? (uint64_t)st.st_size : 0;
+        if (!usageLedger.reserve(user, fsize, existing, up.reserved)) {
+            err = "Quota exceeded";
+            return false;
+        }
+    }
+    string dir = target.parent_path().string();
+    if (dir.empty()) dir = ".";
+    up.finalPath = savePath;
+    up.tmpPath = dir + "/" + UPLOAD_TMP_PREFIX + target.filename().string() + "." + generate_salt(8);
+    up.direct = streamed && serverConfig.directIoMinBytes > 0 && fsize >= serverConfig.directIoMinBytes;
+
+    int flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+    TraceSpan openSpan("open");
+    openSpan.setDetail(up.tmpPath);
+    up.fd = open(up.tmpPath.c_str(), flags | (up.direct ? O_DIRECT : 0), 0644);
+    if (up.fd < 0 && up.direct && errno == EINVAL) {
+        // filesystem without O_DIRECT support (tmpfs etc.)
+        up.direct = false;
+        up.fd = open(up.tmpPath.c_str(), flags, 0644);
+    }
+    if (up.fd < 0) {
+        usageLedger.release(up.user, up.reserved);
+        up.reserved = 0;
+        err = "Cannot create file";
+        return false;
+    }
+    up.version = uploadVersions.claim(savePath);
+
+    openSpan.end();
+
+    if (streamed && fsize > 0) {
+        TraceSpan allocSpan("fallocate", "io", fsize);
+        int rc = posix_fallocate(up.fd, 0, (off_t)fsize);
+        if (rc == ENOSPC || rc == EFBIG) {
+            abortUpload(up);
+            err = "Not enough space";
+            return false;
+        }
+        // EOPNOTSUPP etc.: fall back to growing the file as it is written
+    }
+    return true;
+}
+
+// write-behind: this thread only receives into the ring, a writer thread
+// drains it to disk. A slow disk fills the ring and then throttles the
+// sender through TCP, but the two no longer wait for each other per buffer.
+static bool receiveUploadPipelined(SockReader &in, UploadFile &up, uint64_t fsize, uint64_t &received) {
+    const size_t align = 4096;
+    BufferRing ring(serverConfig.uploadPipelineDepth, UPLOAD_BUFFER_SIZE, align);
+    if (!ring.ok()) return false;
+
+    atomic<bool> diskOk{true};
+    bool traced = traceSampled();
+    thread writer([&]() {
+        TraceInherit trace(traced);
+        while (BufferRing::Slot *s = ring.pop()) {
+            size_t toWrite = s->len;
+            if (up.direct && toWrite % align != 0) {
+                // last block: O_DIRECT needs whole blocks, the padding is cut off in commitUpload
+                size_t padded = (toWrite + align - 1) / align * align;
+                memset(s->data + toWrite, 0, padded - toWrite);
+                toWrite = padded;
+            }
+            TraceSpan span("write", "io", toWrite);
+            if (diskOk && !write_all(up.fd, s->data, toWrite)) diskOk = false;
+            span.end();
+            ring.release(s);
+        }
+    });
+
+    received = 0;
+    while (received < fsize) {
+        size_t toRead = (size_t)min<uint64_t>(UPLOAD_BUFFER_SIZE, fsize - received);
+        BufferRing::Slot *s = ring.acquire();
+        TraceSpan span("recv", "net", toRead);
+        ssize_t r = in.readExact(s->data, toRead);
+        span.end();
+        if (r <= 0 || (size_t)r < toRead) {
+            ring.release(s);
+            break;
+        }
+        received += r;
+        if (!diskOk) {
+            ring.release(s); // keep draining the socket so the reply stays in sync
+            continue;
+        }
+        s->len = (size_t)r;
+        ring.push(s);
+    }
+    ring.finish();
+    writer.join();
+    return diskOk && received == fsize;
+}
+
+// receive exactly fsize bytes into the temp file; on a disk error the rest is still
+// drained from the socket so the command stream stays in sync
+bool receiveUpload(SockReader &in, UploadFile &up, uint64_t fsize, uint64_t &received) {
+    // a single buffer has nothing to overlap with
+    if (serverConfig.uploadPipelineDepth > 1 && fsize > UPLOAD_BUFFER_SIZE) {
+        return receiveUploadPipelined(in, up, fsize, received);
+    }
+    const size_t align = 4096;
+    char *buf = (char *)aligned_alloc(align, UPLOAD_BUFFER_SIZE);
+    if (!buf) return false;
+
+    bool diskOk = true;
+    received = 0;
+    while (received < fsize) {
+        size_t toRead = (size_t)min<uint64_t>(UPLOAD_BUFFER_SIZE, fsize - received);
+        TraceSpan recvSpan("recv", "net", toRead);
+        ssize_t r = in.readExact(buf, toRead);
+        recvSpan.end();
+        if (r <= 0 || (size_t)r < toRead) break;
+        received += r;
+        if (!diskOk) continue;
+
+        size_t toWrite = (size_t)r;
+        if (up.direct && toWrite % align != 0) {
+            // last block: O_DIRECT needs whole blocks, the padding is cut off in commitUpload
+            size_t padded = (toWrite + align - 1) / align * align;
+            memset(buf + toWrite, 0, padded - toWrite);
+            toWrite = padded;
+        }
+        TraceSpan writeSpan("write", "io", toWrite);
+        if (!write_all(up.fd, buf, toWrite)) diskOk = false;
+    }
+    free(buf);
+    return diskOk && received == fsize;
+}
+
+bool receiveSparseUpload(SockReader &in, UploadFile &up, uint64_t fsize, size_t count, uint64_t &received) {
+    received = 0;
+    vector<Extent> extents;
+    extents.reserve(count);
+    uint64_t end = 0;
+    string line;
+    for (size_t i = 0; i < count; ++i) {
+        Extent e;
+        if (!in.readLine(line) || !parseExtent(line, fsize, end, e)) return false;
+        extents.push_back(e);
+    }
+    bool diskOk = ftruncate(up.fd, (off_t)fsize) == 0;
+
+    vector<char> buf((size_t)min<uint64_t>(extentBytes(extents), UPLOAD_BUFFER_SIZE));
+    for (const Extent &e : extents) {
+        // seeking over a gap leaves it a hole; only the extent itself is written
+        if (diskOk && lseek(up.fd, (off_t)e.offset, SEEK_SET) < 0) diskOk = false;
+        for (uint64_t off = 0; off < e.length;) {
+            size_t toRead = (size_t)min<uint64_t>(buf.size(), e.length - off);
+            TraceSpan recvSpan("recv", "net", toRead);
+            ssize_t r = in.readExact(buf.data(), toRead);
+            recvSpan.end();
+            if (r <= 0 || (size_t)r < toRead) return false;
+            received += r;
+            if (diskOk) {
+                TraceSpan writeSpan("write", "io", toRead);
+                if (!write_all(up.fd, buf.data(), toRead)) diskOk = false;
+            }
+            off += toRead;
+        }
+    }
+    return diskOk;
+}
+
+// flush according to the fsync policy and atomically replace finalPath,
+// unless a newer upload of the same path got there first
+bool commitUpload(UploadFile &up, uint64_t fsize) {
+    bool ok = true;
+    if (up.direct && ftruncate(up.fd, (off_t)fsize) != 0) ok = false;
+    bool sync = shouldFsync(fsize);
+    if (ok && sync) {
+        TraceSpan span("fsync", "io", fsize);
+        if (fsync(up.fd) != 0) ok = false;
+    }
+    close(up.fd);
+    up.fd = -1;
+    bool renamed = false;
+    if (ok) {
+        // the replaced size, the rename and the ledger move together, so two
+        // uploads finishing at once cannot both count the same old file
+        up.superseded = !uploadVersions.finish(up.finalPath, up.version, [&]() {
+            struct stat old;
+            up.replacedSize = stat(up.finalPath.c_str(), &old) == 0 ? (int64_t)old.st_size : -1;
+            TraceSpan span("rename");
+            span.setDetail(up.finalPath);
+            renamed = rename(up.tmpPath.c_str(), up.finalPath.c_str()) == 0;
+            if (renamed && !up.user.empty()) usageLedger.fileStored(up.user, fsize, up.replacedSize);
+        });
+    } else {
+        uploadVersions.abandon(up.finalPath);
+    }
+    up.version = 0;
+    usageLedger.release(up.user, up.reserved);
+    up.reserved = 0;
+    if (up.superseded) {
+        unlink(up.tmpPath.c_str());
+        cout << "[LOG] Upload superseded by a newer one: " << up.finalPath << "\n";
+        return true;
+    }
+    if (!renamed) {
+        unlink(up.tmpPath.c_str());
+        return false;
+    }
+    if (sync) fsyncDir(fs::path(up.finalPath).parent_path().string());
+    return true;
+}
+
+void abortUpload(UploadFile &up) {
+    if (up.version) uploadVersions.abandon(up.finalPath);
+    up.version = 0;
+    usageLedger.release(up.user, up.reserved);
+    up.reserved = 0;
+    if (up.fd >= 0) close(up.fd);
+    up.fd = -1;
+    if (!up.tmpPath.empty()) unlink(up.tmpPath.c_str());
+}
+
+// read a whole file of at most maxSize bytes, going through fileCache.
+// nullptr if it does not exist (exists = false) or is bigger (fsize is set).
+shared_ptr<const string> loadSmallFile(const string &filepath, uint64_t maxSize, bool &exists, uint64_t &fsize,
+                                       int *fdOut) {
+    if (fdOut) *fdOut = -1;
+    string key = fs::path(filepath).lexically_normal().string();
+    shared_ptr<const string> cached = fileCache.get(key);
+    if (cached) {
+        exists = true;
+        fsize = cached->size();
+        return cached;
+    }
+
+    // the token comes before the open: an upload that commits after it makes
+    // our put() a no-op instead of caching the version we are about to read
+    uint64_t token = fileCache.loadToken();
+
+    // open first and size the fd: uploads replace files by rename, so the fd
+    // pins one version and size and content cannot come from different ones
+    TraceSpan openSpan("open");
+    openSpan.setDetail(filepath);
+    int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    openSpan.end();
+    struct stat st;
+    exists = fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (exists) fsize = (uint64_t)st.st_size;
+
+    if (exists && fsize <= maxSize) {
+        TraceSpan readSpan("read", "io", fsize);
+        auto data = make_shared<string>(fsize, '\0');
+        uint64_t got = 0;
+        while (got < fsize) {
+            ssize_t r = pread(fd, &(*data)[got], (size_t)(fsize - got), (off_t)got);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            got += (uint64_t)r;
+        }
+        if (got == fsize) {
+            close(fd);
+            fileCache.put(key, data, token);
+            return data;
+        }
+        // truncated in place under us: the caller streams whatever is there
+    }
+    if (exists && fdOut) {
+        *fdOut = fd;
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    return nullptr;
+}
+
+// fill buf with want bytes from off; a file that shrank reads as zeros so the
+// announced size still holds
+static void readChunk(int fd, char *buf, size_t want, uint64_t off) {
+    size_t got = 0;
+    while (got < want) {
+        ssize_t r = pread(fd, buf + got, want - got, (off_t)(off + got));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            memset(buf + got, 0, want - got);
+            return;
+        }
+        got += (size_t)r;
+    }
+}
+
+bool streamFromDisk(int fd, uint64_t fsize, const string &path, const function<bool(const char *, size_t)> &sink) {
+    return streamExtents(fd, vector<Extent>{{0, fsize}}, path, sink);
+}
+
+bool streamExtents(int fd, const vector<Extent> &extents, const string &path,
+                   const function<bool(const char *, size_t)> &sink) {
+    size_t depth = (size_t)max(1, serverConfig.downloadPipelineDepth);
+    uint64_t total = extentBytes(extents);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (!extents.empty()) {
+        const Extent &first = extents.front();
+        posix_fadvise(fd, (off_t)first.offset, (off_t)min<uint64_t>(first.length, depth * DOWNLOAD_CHUNK), POSIX_FADV_WILLNEED);
+    }
+
+    bool sent = true;
+    if (depth < 2 || total <= DOWNLOAD_CHUNK) {
+        vector<char> buf((size_t)min<uint64_t>(total, DOWNLOAD_CHUNK));
+        for (size_t i = 0; sent && i < extents.size(); ++i) {
+            const Extent &e = extents[i];
+            for (uint64_t off = 0; sent && off < e.length; off += buf.size()) {
+                size_t n = (size_t)min<uint64_t>(buf.size(), e.length - off);
+                {
+                    TraceSpan span("read", "io", n);
+                    readChunk(fd, buf.data(), n, e.offset + off);
+                }
+                TraceSpan span("send", "net", n);
+                sent = sink(buf.data(), n);
+            }
+        }
+    } else {
+        // the prefetch thread stays up to depth chunks ahead of the socket
+        BufferRing ring(depth, DOWNLOAD_CHUNK);
+        if (!ring.ok()) return false;
+        bool traced = traceSampled();
+        thread reader([&]() {
+            TraceInherit trace(traced);
+            for (const Extent &e : extents) {
+                uint64_t end = e.offset + e.length;
+                for (uint64_t off = e.offset; off < end; off += DOWNLOAD_CHUNK) {
+                    BufferRing::Slot *s = ring.acquire();
+                    if (!s) return; // the sender gave up
+                    uint64_t ahead = off + depth * DOWNLOAD_CHUNK;
+                    if (ahead < end) posix_fadvise(fd, (off_t)ahead, DOWNLOAD_CHUNK, POSIX_FADV_WILLNEED);
+                    s->len = (size_t)min<uint64_t>(DOWNLOAD_CHUNK, end - off);
+                    TraceSpan span("read", "io", s->len);
+                    readChunk(fd, s->data, s->len, off);
+                    span.end();
+                    ring.push(s);
+                }
+            }
+            ring.finish();
+        });
+        while (BufferRing::Slot *s = ring.pop()) {
+            TraceSpan span("send", "net", s->len);
+            if (!sink(s->data, s->len)) {
+                sent = false;
+                ring.cancel();
+                break;
+            }
+            ring.release(s);
+        }
+        reader.join();
+    }
+    // a one-off download should not push hot files out of the page cache
+    if (sent && !fileCache.hot(fs::path(path).lexically_normal().string())) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    return sent;
+}
+
+// send "OK\n<size>\n" then send data from file; small hot files come from fileCache
+uint64_t sendFileToClient(int clientSock, const string &filepath) {
+    bool exists = false;
+    uint64_t fsize = 0;
+    uint64_t maxInMemory = fileCache.enabled() ? serverConfig.cacheMaxFileBytes : 0;
+    int fd = -1;
+    shared_ptr<const string> data = loadSmallFile(filepath, maxInMemory, exists, fsize, &fd);
+    if (!exists) {
         string err = "ERROR: File not found\n";
         send_all(clientSock, err.c_str(), err.size());
-        return;
+        return 0;
+    }
+    tuneTransferSocket(clientSock, true);
+    if (data) {
+        string header = "OK\n" + to_string((unsigned long long)data->size()) + "\n";
+        return send_allv(clientSock, header.data(), header.size(), data->data(), data->size()) ? data->size() : 0;
     }
 
-    uintmax_t fsize = fs::file_size(filepath);
-    // send header
+    // fd and fsize belong to the version that was there when we opened it; an
+    // upload committing meanwhile renames a new file in without touching ours
     string header = "OK\n" + to_string((unsigned long long)fsize) + "\n";
-    if (!send_all(clientSock, header.c_str(), header.size())) return;
+    bool ok;
+    {
+        // the header rides in the first full segment of data, the tail leaves at uncork
+        SocketCork cork(clientSock);
+        ok = send_all(clientSock, header.c_str(), header.size()) &&
+             streamFromDisk(fd, fsize, filepath, [clientSock](const char *p, size_t n) { return send_all(clientSock, p, n); });
+    }
+    close(fd);
+    return ok ? fsize : 0;
+}
 
-    // send file bytes
-    ifstream in(filepath, ios::binary);
-    if (!in.is_open()) return;
-    char buffer[BUFFER_SIZE];
-    while (in) {
-        in.read(buffer, sizeof(buffer));
-        streamsize readBytes = in.gcount();
-        if (readBytes > 0) {
-            if (!send_all(clientSock, buffer, (size_t)readBytes)) break;
-        }
+// GETSPARSE: "OK\n" + the extent map of sparse_map.h + the data extents.
+// Always read from disk; the cache holds whole files and no hole information.
+uint64_t sendSparseToClient(int clientSock, const string &filepath) {
+    TraceSpan openSpan("open");
+    openSpan.setDetail(filepath);
+    int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    openSpan.end();
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        string err = "ERROR: File not found\n";
+        send_all(clientSock, err.c_str(), err.size());
+        return 0;
     }
-    in.close();
+    TraceSpan mapSpan("extents");
+    vector<Extent> extents = dataExtents(fd, (uint64_t)st.st_size);
+    mapSpan.end();
+    tuneTransferSocket(clientSock, true);
+    string header = "OK\n" + extentMap((uint64_t)st.st_size, extents);
+    bool ok;
+    {
+        SocketCork cork(clientSock);
+        ok = send_all(clientSock, header.c_str(), header.size()) &&
+             streamExtents(fd, extents, filepath, [clientSock](const char *p, size_t n) { return send_all(clientSock, p, n); });
+    }
+    close(fd);
+    return ok ? extentBytes(extents) : 0;
 }
 
 // helper to send a text message as a size-prefixed block (used for LIST, HELP, LISTALL)
 void sendTextBlock(int clientSock, const string &text) {
     string header = "OK\n" + to_string((unsigned long long)text.size()) + "\n";
-    if (!send_all(clientSock, header.c_str(), header.size())) return;
-    send_all(clientSock, text.c_str(), text.size());
+    send_allv(clientSock, header.data(), header.size(), text.data(), text.size());
 }
 
-// users file operations
-bool registerUser(const string &username, const string &password) {
-    lock_guard<mutex> lock(usersMutex);
+// a relative path from a directory stream: no root, no "..", not empty
+bool safeRelativePath(const string &rel) {
+    if (rel.empty() || rel[0] == '/') return false;
+    for (const auto &part : fs::path(rel)) {
+        if (part == "..") return false;
+    }
+    return true;
+}
 
-    ifstream in_check(USERS_FILE);
-    string u, s, h;
-    while (in_check >> u >> s >> h) {
-        if (u == username) {
+// path is dir itself or lies below it; a bare prefix compare would let
+// /srv/bobby pass as inside /srv/bob
+bool pathWithin(const string &path, const string &dir) {
+    if (path.compare(0, dir.size(), dir) != 0) return false;
+    return path.size() == dir.size() || path[dir.size()] == '/' || (!dir.empty() && dir.back() == '/');
+}
+
+// create dir and each missing ancestor one level at a time, so every new directory
+// is charged to the user and announced; true if dir is a directory afterwards
+bool createDirectories(const string &user, const fs::path &dir) {
+    fs::path target = dir.lexically_normal();
+    if (!target.has_filename()) target = target.parent_path();
+    error_code ec;
+    vector<fs::path> missing;
+    for (fs::path p = target; !p.empty() && !fs::exists(p, ec); p = p.parent_path()) {
+        missing.push_back(p);
+        if (p == p.parent_path()) break;
+    }
+    for (auto it = missing.rbegin(); it != missing.rend(); ++it) {
+        if (fs::create_directory(*it, ec)) {
+            usageLedger.dirCreated(user);
+            dirChanged(it->string());
+        } else if (ec) {
             return false;
         }
     }
-    in_check.close();
+    return fs::is_directory(target, ec);
+}
+
+// PUTDIR stream, sent after our READY:
+//   D <relpath>\n                     directory
+//   F <size> <relpath>\n<size bytes>  file
+//   END\n
+// bad entries are skipped (their data is still consumed) and counted in the reply
+void receiveDirFromClient(int clientSock, const string &targetDir, const string &user) {
+    SockReader in(clientSock);
+    uint64_t files = 0, dirs = 0, bytes = 0, errors = 0;
+    string line;
+    bool complete = false;
+
+    while (in.readLine(line)) {
+        if (line == "END") {
+            complete = true;
+            break;
+        }
+        if (line.size() < 3 || line[1] != ' ') break;
+
+        if (line[0] == 'D') {
+            string rel = line.substr(2);
+            if (safeRelativePath(rel) && createDirectories(user, fs::path(targetDir) / rel)) {
+                ++dirs;
+            } else {
+                ++errors;
+            }
+        } else if (line[0] == 'F') {
+            size_t sp = line.find(' ', 2);
+            if (sp == string::npos) break;
+            uint64_t fsize = 0;
+            try {
+                fsize = stoull(line.substr(2, sp - 2));
+            } catch (...) {
+                break;
+            }
+            string rel = line.substr(sp + 1);
+            string savePath = (fs::path(targetDir) / rel).lexically_normal().string();
+
+            UploadFile up;
+            string err;
+            bool ok = safeRelativePath(rel);
+            if (ok) {
+                ok = createDirectories(user, fs::path(savePath).parent_path()) &&
+                     beginUpload(up, savePath, fsize, err, user);
+            }
+            if (!ok) {
+                // drain the data we are not going to store
+                char skip[BUFFER_SIZE];
+                uint64_t left = fsize;
+                while (left > 0) {
+                    size_t n = (size_t)min<uint64_t>(sizeof(skip), left);
+                    if (in.readExact(skip, n) != (ssize_t)n) break;
+                    left -= n;
+                }
+                if (left > 0) break;
+                ++errors;
+                continue;
+            }
+
+            uint64_t received = 0;
+            if (!receiveUpload(in, up, fsize, received)) {
+                abortUpload(up);
+                if (received < fsize) break; // connection lost
+                ++errors;
+                continue;
+            }
+            if (commitUpload(up, fsize)) {
+                fileChanged(savePath);
+                ++files;
+                bytes += fsize;
+            } else {
+                ++errors;
+            }
+        } else {
+            break;
+        }
+    }
+
+    cout << "[LOG] PUTDIR " << targetDir << ": " << files << " files, " << dirs << " dirs, "
+         << bytes << " bytes, " << errors << " errors\n";
+    if (!complete) {
+        string msg = "ERROR: Broken directory stream\n";
+        send_all(clientSock, msg.c_str(), msg.size());
+        return;
+    }
+    string msg = "OK\n" + to_string(files) + " files, " + to_string(dirs) + " dirs, " +
+                 to_string(bytes) + " bytes, " + to_string(errors) + " errors\n";
+    send_all(clientSock, msg.c_str(), msg.size());
+}
+
+// GETDIR: "OK\n" followed by the same stream as PUTDIR. Headers and small
+// files are packed into one buffer so a tree of tiny files goes out in few sends.
+void sendDirToClient(int clientSock, const string &dir) {
+    string listing;
+    list_directory_recursive(dir, "", listing);
+
+    string out = "OK\n";
+    out.reserve(UPLOAD_BUFFER_SIZE + BUFFER_SIZE);
+    auto flush = [&]() {
+        bool ok = send_all(clientSock, out.data(), out.size());
+        out.clear();
+        return ok;
+    };
+
+    istringstream entries(listing);
+    string rel;
+    while (getline(entries, rel)) {
+        if (rel.empty()) continue;
+        if (rel.back() == '/') {
+            rel.pop_back();
+            out += "D " + rel + "\n";
+        } else {
+            string path = (fs::path(dir) / rel).string();
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (fd < 0) continue; // removed since the listing
+            if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                close(fd);
+                continue;
+            }
+            uint64_t fsize = (uint64_t)st.st_size;
+            out += "F " + to_string(fsize) + " " + rel + "\n";
+
+            // keep exactly fsize bytes in the stream even if the file shrank meanwhile
+            uint64_t left = fsize;
+            char buf[UPLOAD_BUFFER_SIZE / 4];
+            while (left > 0) {
+                size_t want = (size_t)min<uint64_t>(sizeof(buf), left);
+                ssize_t r = read(fd, buf, want);
+                if (r < 0 && errno == EINTR) continue;
+                if (r <= 0) {
+                    r = (ssize_t)want;
+                    memset(buf, 0, want);
+                }
+                out.append(buf, (size_t)r);
+                left -= (uint64_t)r;
+                if (out.size() >= UPLOAD_BUFFER_SIZE && !flush()) {
+                    close(fd);
+                    return;
+                }
+            }
+            close(fd);
+        }
+        if (out.size() >= UPLOAD_BUFFER_SIZE && !flush()) return;
+    }
+    out += "END\n";
+    flush();
+}
+
+// PUTPACK body, after our READY: <count> entries of "<size> <name>\n<data>".
+// The whole pack is received with one buffered read, then each file is stored;
+// the reply lists "<name> OK" or "<name> ERROR <reason>" per file.
+void receivePackFromClient(int clientSock, const string &dir, size_t count, uint64_t totalBytes, const string &user) {
+    string body(totalBytes, '\0');
+    if (totalBytes > 0 && recv_exact(clientSock, &body[0], totalBytes) != (ssize_t)totalBytes) return;
+
+    string report;
+    size_t pos = 0, stored = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t nl = body.find('\n', pos);
+        size_t sp = body.find(' ', pos);
+        if (nl == string::npos || sp == string::npos || sp > nl) break;
+        uint64_t fsize = 0;
+        try {
+            fsize = stoull(body.substr(pos, sp - pos));
+        } catch (...) {
+            break;
+        }
+        string name = fs::path(body.substr(sp + 1, nl - sp - 1)).filename().string();
+        pos = nl + 1;
+        if (fsize > body.size() - pos) break;
+        const char *data = body.data() + pos;
+        pos += fsize;
+
+        if (name.empty() || name == "." || name == "..") {
+            report += name + " ERROR Bad name\n";
+            continue;
+        }
+        string savePath = dir + "/" + name;
+        UploadFile up;
+        string err;
+        if (!beginUpload(up, savePath, fsize, err, user)) {
+            report += name + " ERROR " + err + "\n";
+            continue;
+        }
+        if (fsize > 0 && !write_all(up.fd, data, fsize)) {
+            abortUpload(up);
+            report += name + " ERROR Write failed\n";
+            continue;
+        }
+        if (!commitUpload(up, fsize)) {
+            report += name + " ERROR Cannot save file\n";
+            continue;
+        }
+        fileChanged(savePath);
+        report += name + " OK\n";
+        ++stored;
+    }
+    if (pos != body.size()) report += "ERROR: Malformed pack\n";
+
+    cout << "[LOG] PUTPACK " << dir << ": " << stored << " of " << count << " files\n";
+    sendTextBlock(clientSock, report);
+}
+
+// GETPACK reply: "OK\n<size>\n" then, per requested name, "OK <size> <name>\n<data>"
+// or "ERROR 0 <name>\n". Files come through loadSmallFile, so hot ones never hit the disk.
+void sendPackToClient(int clientSock, const string &dir, const vector<string> &names) {
+    string body;
+    for (const auto &n : names) {
+        string name = fs::path(n).filename().string();
+        bool exists = false;
+        uint64_t fsize = 0;
+        shared_ptr<const string> data;
+        if (!name.empty() && body.size() < PACK_MAX_BYTES) {
+            data = loadSmallFile(dir + "/" + name, min<uint64_t>(PACK_MAX_FILE_BYTES, PACK_MAX_BYTES - body.size()), exists, fsize);
+        }
+        if (!data) {
+            body += "ERROR 0 " + name + "\n";
+            continue;
+        }
+        body += "OK " + to_string((unsigned long long)data->size()) + " " + name + "\n";
+        body += *data;
+    }
+    sendTextBlock(clientSock, body);
+}
+
+// counters shown by STATS, one "name value" pair per line
+string serverStats() {
+    return fileCache.stats() + "index_entries " + to_string(pathIndex.size()) + "\n" + sessionRegistry.stats() +
+           storageMap.stats() + authPool.stats() + watchHub.stats() + uploadVersions.stats();
+}
 
-    string salt = generate_salt(16);
-    string pass_with_salt = password + salt;
-    string hashed_password = picosha2::hash256_hex_string(pass_with_salt);
+// users file operations. usersMutex only covers reading and writing the
+// file; hashing runs on the auth pool in between.
 
-    ofstream out(USERS_FILE, ios::app);
-    out << username << " " << salt << " " << hashed_password << "\n";
+// helper: the users.txt entry of username; false if there is none
+static bool findUserEntry(const string &username, PasswordEntry &e) {
+    lock_guard<mutex> lock(usersMutex);
+    ifstream in(USERS_FILE);
+    string u, s, h;
+    while (in >> u >> s >> h) {
+        if (u == username) return parsePasswordEntry(s, h, e);
+    }
+    return false;
+}
+
+// helper: swap in a rehashed entry, unless the stored one changed meanwhile
+static bool replaceUserEntry(const string &username, const PasswordEntry &old, const PasswordEntry &e) {
+    lock_guard<mutex> lock(usersMutex);
+    ifstream in(USERS_FILE);
+    string tmp = USERS_FILE + ".tmp";
+    ofstream out(tmp, ios::trunc);
+    string u, s, h;
+    bool replaced = false;
+    while (in >> u >> s >> h) {
+        if (u == username && h == old.hash) {
+            s = saltField(e);
+            h = e.hash;
+            replaced = true;
+        }
+        out << u << " " << s << " " << h << "\n";
+    }
+    in.close();
     out.close();
+    error_code ec;
+    if (!replaced || !out || (fs::rename(tmp, USERS_FILE, ec), ec)) {
+        fs::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool registerUser(const string &username, const string &password) {
+    PasswordEntry e;
+    if (findUserEntry(username, e)) return false; // taken: do not spend a hash on it
+
+    e.salt = generate_salt(16);
+    e.iterations = serverConfig.authIterations;
+    authPool.run([&password, &e]() {
+        hashPassword(password, e);
+        return true;
+    });
+
+    {
+        lock_guard<mutex> lock(usersMutex);
+        // another REGISTER for the name may have finished while we hashed
+        ifstream in_check(USERS_FILE);
+        string u, s, h;
+        while (in_check >> u >> s >> h) {
+            if (u == username) {
+                return false;
+            }
+        }
+        in_check.close();
+
+        ofstream out(USERS_FILE, ios::app);
+        out << username << " " << saltField(e) << " " << e.hash << "\n";
+        out.close();
+    }
 
-    ensureDir(BASE_DIR + username);
+    ensureDir(storageMap.placeNewUser(username));
     cout << "[LOG] Registered user: " << username << endl;
     return true;
 }
 
 bool checkUser(const string &username, const string &password) {
-    lock_guard<mutex> lock(usersMutex);
-    ifstream in(USERS_FILE);
+    PasswordEntry stored;
+    bool known = findUserEntry(username, stored);
+    if (!known) {
+        // same work as a real check, so timing does not tell which names exist
+        stored.salt = "unknown-user";
+        stored.iterations = serverConfig.authIterations;
+    }
+    PasswordEntry upgraded;
+    bool ok = authPool.run([&]() {
+        if (!verifyPassword(password, stored) || !known) return false;
+        // legacy or cheaper than configured: rehash while we have the password
+        if (stored.iterations < serverConfig.authIterations) {
+            upgraded.salt = generate_salt(16);
+            upgraded.iterations = serverConfig.authIterations;
+            hashPassword(password, upgraded);
+        }
+        return true;
+    });
+    if (ok && !upgraded.hash.empty() && replaceUserEntry(username, stored, upgraded)) {
+        cout << "[LOG] Rehashed password of " << username << " (pbkdf2, " << upgraded.iterations << " iterations)" << endl;
+    }
+    return ok;
+}
 
-    string u, stored_salt, stored_hash;
-    while (in >> u >> stored_salt >> stored_hash) {
-        if (u == username) {
-            string pass_with_salt = password + stored_salt;
-            string hashed_attempt = picosha2::hash256_hex_string(pass_with_salt);
-            
-            return hashed_attempt == stored_hash;
+// key of a server path in pathIndex: "user/dir/file", empty if outside every home
+static string indexKey(const string &path) {
+    string key;
+    return storageMap.keyOf(path, key) ? key : "";
+}
+
+// helper: tell WATCH subscribers; a path that still exists was created or changed
+static void notifyWatchers(const string &key, const string &path, bool isDir) {
+    if (key.empty() || !watchHub.active()) return;
+    struct stat st;
+    bool exists = lstat(path.c_str(), &st) == 0;
+    if (exists) isDir = S_ISDIR(st.st_mode);
+    watchHub.publish(isDir ? key + "/" : key, exists ? 'C' : 'D');
+}
+
+// a file was written or removed: drop cached content, refresh its index entry
+void fileChanged(const string &path) {
+    fileCache.invalidate(fs::path(path).lexically_normal().string());
+    string key = indexKey(path);
+    if (!key.empty()) pathIndex.refresh(key, path);
+    notifyWatchers(key, path, false);
+}
+
+void dirChanged(const string &path) {
+    string key = indexKey(path);
+    if (!key.empty()) pathIndex.refresh(key, path);
+    notifyWatchers(key, path, true);
+}
+
+// FIND <pattern> [-prefix|-glob|-substr] [-files] [-min <bytes>] [-max <bytes>]
+//      [-newer <epoch>] [-older <epoch>] [-offset <n>] [-limit <n>]
+// without a mode flag, patterns containing * ? [ are globs, others substrings
+string findReport(const string &args, string &err) {
+    FindQuery q;
+    istringstream iss(args);
+    string tok;
+    bool modeSet = false;
+    try {
+        while (iss >> tok) {
+            string val;
+            if (tok == "-prefix") { q.mode = FindMode::Prefix; modeSet = true; }
+            else if (tok == "-glob") { q.mode = FindMode::Glob; modeSet = true; }
+            else if (tok == "-substr") { q.mode = FindMode::Substring; modeSet = true; }
+            else if (tok == "-files") q.filesOnly = true;
+            else if (tok == "-min" && iss >> val) q.minSize = stoull(val);
+            else if (tok == "-max" && iss >> val) q.maxSize = stoull(val);
+            else if (tok == "-newer" && iss >> val) q.newerThan = (time_t)stoll(val);
+            else if (tok == "-older" && iss >> val) q.olderThan = (time_t)stoll(val);
+            else if (tok == "-offset" && iss >> val) q.offset = stoull(val);
+            else if (tok == "-limit" && iss >> val) q.limit = min<size_t>(stoull(val), FIND_MAX_LIMIT);
+            else if (!tok.empty() && tok[0] == '-') { err = "Unknown FIND option " + tok; return ""; }
+            else q.pattern = tok;
         }
+    } catch (...) {
+        err = "Bad FIND value";
+        return "";
     }
-    return false;
+    if (!modeSet && q.pattern.find_first_of("*?[") != string::npos) q.mode = FindMode::Glob;
+
+    size_t total = 0;
+    auto page = pathIndex.find(q, total);
+    string out = "total " + to_string(total) + " offset " + to_string(q.offset) + " count " + to_string(page.size()) + "\n";
+    for (const auto &kv : page) {
+        out += kv.first + (kv.second.isDir ? "/" : "") + "\t" + to_string(kv.second.size) + "\t" +
+               to_string((long long)kv.second.mtime) + "\n";
+    }
+    return out;
 }
 
-void handleClient(int clientSock) {
-    string username;
-    bool authenticated = false;
-    string userHomeDir;
-    string currentPath;
+// USAGE reply: O(1) from the ledger
+string usageReport(const string &user) {
+    UserUsage u = usageLedger.usage(user);
+    uint64_t q = usageLedger.quota(user);
+    return "used_bytes " + to_string(u.bytes) + "\n" +
+           "files " + to_string(u.files) + "\n" +
+           "dirs " + to_string(u.dirs) + "\n" +
+           "in_flight_bytes " + to_string(u.reserved) + "\n" +
+           "quota_bytes " + (q ? to_string(q) : string("unlimited")) + "\n";
+}
+
+// follow the user's home to another storage root after a migration
+void refreshHome(Session &s) {
+    if (!s.authenticated) return;
+    string home = fs::path(storageMap.homeOf(s.username)).lexically_normal().string();
+    if (home == s.userHomeDir) return;
+    s.currentPath = home + s.currentPath.substr(s.userHomeDir.size());
+    s.userHomeDir = home;
+}
+
+// "user/rel/path" of GETALL to a path in that user's home; empty if malformed
+string resolveUserPath(const string &userPath, string &user) {
+    TraceSpan span("resolve", "path");
+    string rem = userPath;
+    if (!rem.empty() && rem[0] == '/') rem.erase(0, 1);
+    size_t slash = rem.find('/');
+    if (slash == string::npos || slash == 0) return "";
+    user = rem.substr(0, slash);
+    if (user == "." || user == "..") return "";
+    string rel = rem.substr(slash + 1);
+    if (!safeRelativePath(rel)) return "";
+    string home = storageMap.homeOf(user);
+    string path = home + "/" + rel;
+    if (!pathWithin(fs::path(path).lexically_normal().string(), fs::path(home).lexically_normal().string())) return "";
+    return path;
+}
+
+bool loginSession(Session &s, const string &username, const string &password) {
+    TraceSpan authSpan("auth", "auth");
+    if (!checkUser(username, password)) return false;
+    authSpan.end();
+    s.username = username;
+    s.authenticated = true;
+    s.userHomeDir = fs::path(storageMap.homeOf(username)).lexically_normal().string();
+    s.currentPath = s.userHomeDir;
+    ensureDir(s.currentPath);
+    cout << "[LOG] User logged in: " << username << endl;
+    return true;
+}
+
+string helpText() {
+    return
+        "Available commands:\n"
+        "REGISTER <username> <password>\n"
+        "LOGIN <username> <password>\n"
+        "PUT <local_path>          (Upload file to current dir)\n"
+        "GET <filename>            (Download file from current dir)\n"
+        "PUTSPARSE <local_path>    (Upload a sparse file: only data extents, holes kept)\n"
+        "GETSPARSE <filename>      (Download a sparse file: only data extents, holes kept)\n"
+        "LIST [options]            (List files in current dir: -d <depth> -l\n"
+        "                           -sort name|size|mtime -r -offset/-limit <n>)\n"
+        "PWD                       (Show current server directory)\n"
+        "CD <dirname>              (Change server directory)\n"
+        "MKDIR <dirname>           (Create directory)\n"
+        "DELETE <filename>         (Delete file)\n"
+        "COPY <source> <target>    (Copy on the server; source /user/path = any user's file)\n"
+        "MOVE <source> <target>    (Move or rename a file or directory)\n"
+        "LISTALL [options]         (List all files from all users, LIST options)\n"
+        "GETALL <user/file>        (Download any user's file)\n"
+        "PUTDIR <local_dir>        (Upload a directory tree to current dir)\n"
+        "GETDIR <dirname>          (Download a directory tree)\n"
+        "PUTPACK <files...>        (Upload many small files in one message)\n"
+        "GETPACK <files...>        (Download many small files in one message)\n"
+        "FIND <pattern> [options]  (Search all files: -prefix -glob -substr -files\n"
+        "                           -min/-max <bytes> -newer/-older <epoch> -offset/-limit <n>)\n"
+        "WATCH [dir]               (Push change events for a subtree until UNWATCH;\n"
+        "                           /user/dir = any user's, / = every home)\n"
+        "USAGE                     (Show your storage use and quota)\n"
+        "STATS                     (Show server statistics)\n"
+        "HELP\n"
+        "EXIT\n";
+}
+
+bool parseListOptions(const string &args, ListOptions &opts, string &err) {
+    istringstream iss(args);
+    string tok, val;
+    try {
+        while (iss >> tok) {
+            if (tok == "-l") opts.longFormat = true;
+            else if (tok == "-r") opts.reverse = true;
+            else if (tok == "-d" && iss >> val) opts.maxDepth = stoi(val);
+            else if (tok == "-offset" && iss >> val) opts.offset = stoull(val);
+            else if (tok == "-limit" && iss >> val) opts.limit = stoull(val);
+            else if (tok == "-sort" && iss >> val) {
+                if (val == "name") opts.sort = ListSort::Name;
+                else if (val == "size") opts.sort = ListSort::Size;
+                else if (val == "mtime") opts.sort = ListSort::Mtime;
+                else { err = "Unknown sort key " + val; return false; }
+            } else { err = "Unknown LIST option " + tok; return false; }
+        }
+    } catch (...) {
+        err = "Bad LIST value";
+        return false;
+    }
+    if (opts.maxDepth == 0 || opts.maxDepth < -1) { err = "Depth must be positive"; return false; }
+    return true;
+}
+
+// helper: sort, page and print collected entries under a header line
+static string formatListing(const string &header, vector<ListEntry> &entries, const ListOptions &opts) {
+    auto key = [&](const ListEntry &a, const ListEntry &b) {
+        if (opts.sort == ListSort::Size && a.size != b.size) return a.size < b.size;
+        if (opts.sort == ListSort::Mtime && a.mtime != b.mtime) return a.mtime < b.mtime;
+        return a.name < b.name;
+    };
+    if (opts.sort != ListSort::None) {
+        if (opts.reverse) sort(entries.begin(), entries.end(), [&](const ListEntry &a, const ListEntry &b) { return key(b, a); });
+        else sort(entries.begin(), entries.end(), key);
+    } else if (opts.reverse) {
+        reverse(entries.begin(), entries.end());
+    }
+
+    size_t total = entries.size();
+    size_t first = min(opts.offset, total);
+    size_t last = opts.limit ? min(total, first + opts.limit) : total;
+
+    string list = header;
+    if (opts.offset || opts.limit) {
+        list += "total " + to_string(total) + " offset " + to_string(first) + " count " + to_string(last - first) + "\n";
+    }
+    for (size_t i = first; i < last; ++i) {
+        const ListEntry &e = entries[i];
+        list += e.name;
+        if (opts.longFormat) list += "\t" + to_string(e.size) + "\t" + to_string(e.mtime);
+        list += "\n";
+    }
+    return list;
+}
+
+// metadata is only fetched when it is printed or sorted on
+static bool listNeedsStat(const ListOptions &opts) {
+    return opts.longFormat || opts.sort == ListSort::Size || opts.sort == ListSort::Mtime;
+}
+
+string listCurrentDir(const Session &s, const ListOptions &opts) {
+    vector<ListEntry> entries;
+    if (fs::exists(s.currentPath)) {
+        collectListEntries(s.currentPath, "", opts.maxDepth, listNeedsStat(opts), entries);
+    }
+    return formatListing("Files in current directory:\n", entries, opts);
+}
+
+string listAllFiles(const ListOptions &opts) {
+    vector<ListEntry> entries;
+    for (auto &home : storageMap.homes()) {
+        UserHold hold = storageMap.holdUser(home.first);
+        collectListEntries(home.second, home.first + "/", opts.maxDepth, listNeedsStat(opts), entries);
+    }
+    return formatListing("All files:\n", entries, opts);
+}
+
+// current directory as shown to the user: "/" is the home directory
+string relativeDir(const Session &s) {
+    string relativePath = "/";
+    if (s.currentPath.length() > s.userHomeDir.length()) {
+        relativePath += s.currentPath.substr(s.userHomeDir.length() + 1);
+    }
+    return relativePath;
+}
+
+// resolve name against the current directory; false if it leaves the home directory
+bool resolveInHome(const Session &s, const string &name, string &out) {
+    out = (fs::path(s.currentPath) / name).lexically_normal().string();
+    return pathWithin(out, s.userHomeDir);
+}
+
+// MKDIR/DELETE/CD return "" on success, otherwise the error text
+string makeDirectory(const Session &s, const string &dirname) {
+    if (dirname.empty()) return "No directory name specified";
+    string newDir;
+    if (!resolveInHome(s, dirname, newDir)) return "Permission denied";
+    error_code ec;
+    if (!fs::create_directory(newDir, ec)) return "Could not create directory";
+    usageLedger.dirCreated(s.username);
+    dirChanged(newDir);
+    return "";
+}
+
+string deleteFile(const Session &s, const string &filename) {
+    if (filename.empty()) return "No filename specified";
+    string path;
+    if (!resolveInHome(s, filename, path)) return "Permission denied";
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || unlink(path.c_str()) != 0) {
+        return "File not found or could not be deleted";
+    }
+    usageLedger.fileRemoved(s.username, (uint64_t)st.st_size);
+    fileChanged(path);
+    return "";
+}
+
+string changeDirectory(Session &s, const string &dirname) {
+    if (dirname.empty()) return "No directory specified";
+    string newPath;
+    if (!resolveInHome(s, dirname, newPath)) return "Permission denied";
+    error_code ec;
+    if (!fs::is_directory(newPath, ec)) return "Directory not found";
+    s.currentPath = newPath;
+    return "";
+}
+
+// helper: the final path of a COPY/MOVE target; false if it leaves the home
+static bool resolveTarget(const Session &s, const string &dst, const string &srcPath, string &out) {
+    if (!resolveInHome(s, dst, out)) return false;
+    error_code ec;
+    if (fs::is_directory(out, ec)) out = (fs::path(out) / fs::path(srcPath).filename()).lexically_normal().string();
+    return pathWithin(out, s.userHomeDir) && out != s.userHomeDir;
+}
+
+// FICLONE shares the extents (O(1) on btrfs, XFS, bcachefs); copy_file_range
+// keeps the data in the kernel and lets NFS/SMB copy on the server; plain
+// reads and writes are the last resort. Returns the method that worked.
+static const char *copyFileData(int in, int out, uint64_t size) {
+    if (ioctl(out, FICLONE, in) == 0) return "reflink";
+    uint64_t done = 0;
+    while (done < size) {
+        ssize_t n = copy_file_range(in, nullptr, out, nullptr, (size_t)min<uint64_t>(size - done, 1u << 30), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break; // EXDEV, EINVAL, ENOSYS, EOPNOTSUPP: fall back below
+        if (n == 0) return nullptr; // source shrank
+        done += (uint64_t)n;
+    }
+    if (done == size) return "copy_file_range";
+
+    vector<char> buf(UPLOAD_BUFFER_SIZE);
+    while (done < size) {
+        ssize_t n = pread(in, buf.data(), (size_t)min<uint64_t>(buf.size(), size - done), (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return nullptr;
+        for (ssize_t off = 0; off < n;) {
+            ssize_t w = pwrite(out, buf.data() + off, (size_t)(n - off), (off_t)(done + off));
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return nullptr;
+            off += w;
+        }
+        done += (uint64_t)n;
+    }
+    return "read/write";
+}
+
+string copyFile(const Session &s, const string &src, const string &dst) {
+    if (src.empty() || dst.empty()) return "Usage: COPY <source> <target>";
+    string srcPath, owner = s.username;
+    UserHold ownerHold;
+    if (src[0] == '/') {
+        if (resolveUserPath(src, owner).empty()) return "Bad source path";
+        if (owner != s.username) ownerHold = storageMap.holdUser(owner);
+        srcPath = resolveUserPath(src, owner); // may have moved while we waited
+    } else if (!resolveInHome(s, src, srcPath)) {
+        return "Permission denied";
+    }
+    string dstPath;
+    if (!resolveTarget(s, dst, srcPath, dstPath)) return "Permission denied";
+    if (fs::path(dstPath).lexically_normal() == fs::path(srcPath).lexically_normal()) return "Source and target are the same";
+
+    int in = open(srcPath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in < 0 || fstat(in, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (in >= 0) close(in);
+        return "File not found";
+    }
+    uint64_t fsize = (uint64_t)st.st_size;
+    UploadFile up;
+    string err;
+    if (!beginUpload(up, dstPath, fsize, err, s.username, false)) {
+        close(in);
+        return err;
+    }
+    TraceSpan span("copy", "io", fsize);
+    const char *how = copyFileData(in, up.fd, fsize);
+    span.setDetail(how ? how : "failed");
+    span.end();
+    close(in);
+    if (!how) {
+        abortUpload(up);
+        return "Copy failed";
+    }
+    if (!commitUpload(up, fsize)) return "Cannot save file";
+    fileChanged(dstPath);
+    cout << "[LOG] COPY by " << s.username << ": " << srcPath << " -> " << dstPath << " (" << fsize << " bytes, " << how
+         << ")\n";
+    return "";
+}
+
+// helper: index entries of everything below a directory that was moved in
+static void reindexTree(const string &dir) {
+    dirChanged(dir);
+    error_code ec;
+    for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        dirChanged(it->path().string());
+    }
+}
+
+string moveFile(const Session &s, const string &src, const string &dst) {
+    if (src.empty() || dst.empty()) return "Usage: MOVE <source> <target>";
+    string srcPath, dstPath;
+    if (!resolveInHome(s, src, srcPath) || srcPath == s.userHomeDir) return "Permission denied";
+    if (!resolveTarget(s, dst, srcPath, dstPath)) return "Permission denied";
+    struct stat st, old;
+    if (lstat(srcPath.c_str(), &st) != 0 || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))) return "File not found";
+    bool isDir = S_ISDIR(st.st_mode);
+    bool replaces = stat(dstPath.c_str(), &old) == 0 && S_ISREG(old.st_mode);
+    // same home, so same filesystem: a rename, never a copy
+    if (rename(srcPath.c_str(), dstPath.c_str()) != 0) return "Could not move";
+    if (!isDir) {
+        if (replaces && old.st_ino != st.st_ino) usageLedger.fileRemoved(s.username, (uint64_t)old.st_size);
+        fileChanged(srcPath);
+        fileChanged(dstPath);
+    } else {
+        fileCache.invalidatePrefix(fs::path(srcPath).lexically_normal().string() + "/");
+        string key = indexKey(srcPath);
+        if (!key.empty()) pathIndex.removeTree(key);
+        notifyWatchers(key, srcPath, true);
+        reindexTree(dstPath);
+    }
+    cout << "[LOG] MOVE by " << s.username << ": " << srcPath << " -> " << dstPath << "\n";
+    return "";
+}
+
+// the subscription key of WATCH's argument: a directory relative to the current
+// one (default: the current one), "/user/dir" in any home, or "/" for every home
+string watchRoot(const Session &s, const string &dir, string &root) {
+    string path;
+    if (dir == "/") {
+        root.clear();
+        return "";
+    }
+    if (!dir.empty() && dir[0] == '/') {
+        string owner;
+        path = resolveUserPath(dir.substr(1), owner);
+        if (path.empty()) return "Bad remote path";
+    } else if (dir.empty()) {
+        path = s.currentPath;
+    } else if (!resolveInHome(s, dir, path)) {
+        return "Permission denied";
+    }
+    error_code ec;
+    if (!fs::is_directory(path, ec)) return "Directory not found";
+    root = indexKey(path);
+    if (root.empty()) return "Directory not found";
+    return "";
+}
+
+// helper: send what piled up as one batch (or RESYNC if some of it was dropped)
+static bool flushWatch(int clientSock, Watch &w) {
+    map<string, char> events;
+    bool resync = false;
+    w.take(events, resync);
+    if (resync) return send_all(clientSock, "RESYNC\n", 7);
+    if (events.empty()) return true;
+    string batch = "EVENTS " + to_string(events.size()) + "\n";
+    for (const auto &ev : events) {
+        batch += ev.second;
+        batch += ' ';
+        batch += ev.first;
+        batch += '\n';
+    }
+    return send_all(clientSock, batch.data(), batch.size());
+}
 
+bool watchLoop(int clientSock, Watch &w) {
+    using Clock = chrono::steady_clock;
+    Clock::time_point flushAt;
+    bool collecting = false;
     while (true) {
+        int timeout = WATCH_WAKEUP_MS;
+        if (collecting) {
+            auto left = chrono::duration_cast<chrono::milliseconds>(flushAt - Clock::now()).count();
+            timeout = (int)max<int64_t>(0, left);
+        }
+        // while a batch collects, only the socket wakes us: the eventfd stays readable until the take
+        struct pollfd fds[2] = {{clientSock, POLLIN, 0}, {w.fd(), POLLIN, 0}};
+        int r = poll(fds, collecting ? 1 : 2, timeout);
+        if (r < 0 && errno != EINTR) return false;
+        // a subscriber waiting for events is not idle
+        sessionActivity();
+
+        if (r > 0 && fds[0].revents) {
+            string line = recv_line(clientSock);
+            if (line.empty() || line == "EXIT") return false;
+            if (line == "UNWATCH") {
+                string done = "OK\nStopped watching\n";
+                return flushWatch(clientSock, w) && send_all(clientSock, done.c_str(), done.size());
+            }
+            string msg = "ERROR: Watching, send UNWATCH first\n";
+            if (!send_all(clientSock, msg.c_str(), msg.size())) return false;
+        }
+        if (!collecting && r > 0 && (fds[1].revents & POLLIN)) {
+            collecting = true;
+            flushAt = Clock::now() + chrono::milliseconds(serverConfig.watchBatchMs);
+        }
+        if (collecting && Clock::now() >= flushAt) {
+            collecting = false;
+            if (!flushWatch(clientSock, w)) return false;
+        }
+    }
+}
+
+void handleClient(int clientSock) {
+    Session session;
+    string &username = session.username;
+    bool &authenticated = session.authenticated;
+    string &userHomeDir = session.userHomeDir;
+    string &currentPath = session.currentPath;
+    shared_ptr<SessionSlot> slot = sessionRegistry.add(clientSock);
+    bindSessionSlot(slot);
+    session.recordId = recorder.newSession();
+    // every reply leaves in one write (or corked, for streams), so Nagle would only add latency
+    int one = 1;
+    setsockopt(clientSock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    while (!sessionRegistry.draining()) {
         string line = recv_line(clientSock);
         if (line.empty()) break; // connection closed or error
 
+        // from here until the reply is out, the stall timeout applies
+        SessionBusy busy;
+        // and the user's home cannot migrate under the command
+        UserHold hold = authenticated ? storageMap.holdUser(username) : nullptr;
+        refreshHome(session);
+
         // parse command
         istringstream iss(line);
         string cmd;
         iss >> cmd;
+        // never put passwords in a trace
+        TraceCommand traceCmd(cmd.c_str(), cmd == "LOGIN" || cmd == "REGISTER" ? cmd : line);
+        size_t argPos = line.find_first_not_of(' ', line.find(cmd) + cmd.size());
+        RecordCommand rec(session.recordId, cmd, argPos == string::npos ? "" : line.substr(argPos));
 
         if (cmd == "REGISTER") {
             string u, p;
@@ -200,63 +1594,45 @@ void handleClient(int clientSock) {
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
-            if (checkUser(u, p)) {
-                username = u;
-                authenticated = true;
-                userHomeDir = fs::path(BASE_DIR + username).lexically_normal().string();
-                currentPath = userHomeDir;
-                ensureDir(currentPath);
+            if (loginSession(session, u, p)) {
                 string msg = "LOGGED IN\n";
                 send_all(clientSock, msg.c_str(), msg.size());
-                cout << "[LOG] User logged in: " << username << endl;
             } else {
                 string msg = "ERROR: Invalid credentials\n";
                 send_all(clientSock, msg.c_str(), msg.size());
             }
         } else if (cmd == "HELP") {
-            string helpTxt =
-                "Available commands:\n"
-                "REGISTER <username> <password>\n"
-                "LOGIN <username> <password>\n"
-                "PUT <local_path>          (Upload file to current dir)\n"
-                "GET <filename>            (Download file from current dir)\n"
-                "LIST                      (List files in current dir)\n"
-                "PWD                       (Show current server directory)\n"
-                "CD <dirname>              (Change server directory)\n"
-                "MKDIR <dirname>           (Create directory)\n"
-                "DELETE <filename>         (Delete file)\n"
-                "LISTALL                   (List all files from all users)\n"
-                "GETALL <user/file>        (Download any user's file)\n"
-                "HELP\n"
-                "EXIT\n";
-            sendTextBlock(clientSock, helpTxt);
+            sendTextBlock(clientSock, helpText());
         } else if (cmd == "LIST") {
             if (!authenticated) {
                 string msg = "ERROR: Not logged in\n";
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
-            string list = "Files in current directory:\n";
-            if (fs::exists(currentPath)) {
-                list_directory_recursive(currentPath, "", list);
+            ListOptions opts;
+            string rest, err;
+            getline(iss, rest);
+            if (!parseListOptions(rest, opts, err)) {
+                string msg = "ERROR: " + err + "\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
             }
-            sendTextBlock(clientSock, list);
+            sendTextBlock(clientSock, listCurrentDir(session, opts));
         } else if (cmd == "LISTALL") {
             if (!authenticated) {
                 string msg = "ERROR: Not logged in\n";
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
-            string list = "All files:\n";
-            if (fs::exists(BASE_DIR)) {
-                for (auto &u : fs::directory_iterator(BASE_DIR)) {
-                    if (fs::is_directory(u.path())) {
-                        string uname = u.path().filename().string();
-                        list_directory_recursive(u.path(), uname + "/", list);
-                    }
-                }
+            ListOptions opts;
+            string rest, err;
+            getline(iss, rest);
+            if (!parseListOptions(rest, opts, err)) {
+                string msg = "ERROR: " + err + "\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
             }
-            sendTextBlock(clientSock, list);
+            sendTextBlock(clientSock, listAllFiles(opts));
         } else if (cmd == "PUT") {
             if (!authenticated) {
                 string msg = "ERROR: Not logged in\n";
@@ -272,6 +1648,7 @@ void handleClient(int clientSock) {
             }
 
             // respond READY (client will send SIZE)
+            tuneTransferSocket(clientSock, false);
             string ready = "READY\n";
             send_all(clientSock, ready.c_str(), ready.size());
 
@@ -292,33 +1669,105 @@ void handleClient(int clientSock) {
                 continue;
             }
 
+            string cleanName = fs::path(filename).filename().string();
+            string savePath = currentPath + "/" + cleanName;
+
+            UploadFile up;
+            string err;
+            if (!beginUpload(up, savePath, fsize, err, username)) {
+                string msg = "ERROR: " + err + "\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+
             // reply OK
             string ok = "OK\n";
             send_all(clientSock, ok.c_str(), ok.size());
 
+            // receive exact bytes
+            uint64_t received = 0;
+            SockReader in(clientSock);
+            if (!receiveUpload(in, up, fsize, received)) {
+                abortUpload(up);
+                cout << "[LOG] PUT failed: " << savePath << " (" << received << " of " << fsize << " bytes)\n";
+                string msg = "ERROR: Upload failed\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            if (!commitUpload(up, fsize)) {
+                string msg = "ERROR: Cannot save file\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+
+            fileChanged(savePath);
+            rec.addBytes(fsize, 0);
+
+            cout << "[LOG] PUT saved: " << savePath << " (" << received << " bytes)\n";
+            string done = "OK\n";
+            send_all(clientSock, done.c_str(), done.size());
+        } else if (cmd == "PUTSPARSE") {
+            if (!authenticated) {
+                string msg = "ERROR: Not logged in\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            string filename;
+            iss >> filename;
+            if (filename.empty()) {
+                string msg = "ERROR: No filename\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+
+            // as PUT, but the SIZE line also carries the extent count: "SIZE <size> <count>"
+            tuneTransferSocket(clientSock, false);
+            string ready = "READY\n";
+            send_all(clientSock, ready.c_str(), ready.size());
+
+            string sizeLine = recv_line(clientSock);
+            uint64_t fsize = 0, count = 0;
+            if (sizeLine.rfind("SIZE ", 0) != 0 || !parseNumberPair(sizeLine.substr(5), fsize, count) ||
+                count > SPARSE_MAX_EXTENTS) {
+                string msg = "ERROR: Bad SIZE\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+
             string cleanName = fs::path(filename).filename().string();
             string savePath = currentPath + "/" + cleanName;
 
-            ofstream out(savePath, ios::binary);
-            if (!out.is_open()) {
-                string msg = "ERROR: Cannot create file\n";
+            // not streamed: fallocate would allocate the holes we are about to keep
+            UploadFile up;
+            string err;
+            if (!beginUpload(up, savePath, fsize, err, username, false)) {
+                string msg = "ERROR: " + err + "\n";
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
+            string ok = "OK\n";
+            send_all(clientSock, ok.c_str(), ok.size());
 
-            // receive exact bytes
-            size_t received = 0;
-            char buf[BUFFER_SIZE];
-            while (received < fsize) {
-                size_t toRead = min((size_t)BUFFER_SIZE, fsize - received);
-                ssize_t r = recv_exact(clientSock, buf, toRead);
-                if (r <= 0) break;
-                out.write(buf, r);
-                received += r;
+            uint64_t received = 0;
+            SockReader in(clientSock);
+            if (!receiveSparseUpload(in, up, fsize, (size_t)count, received)) {
+                abortUpload(up);
+                cout << "[LOG] PUTSPARSE failed: " << savePath << " (" << received << " data bytes)\n";
+                string msg = "ERROR: Upload failed\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            if (!commitUpload(up, fsize)) {
+                string msg = "ERROR: Cannot save file\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
             }
-            out.close();
 
-            cout << "[LOG] PUT saved: " << savePath << " (" << received << " bytes)\n";
+            fileChanged(savePath);
+            rec.addBytes(received, 0);
+
+            cout << "[LOG] PUTSPARSE saved: " << savePath << " (" << fsize << " bytes, " << received << " of data in "
+                 << count << " extents)\n";
             string done = "OK\n";
             send_all(clientSock, done.c_str(), done.size());
         } else if (cmd == "GET") {
@@ -337,7 +1786,24 @@ void handleClient(int clientSock) {
             string cleanName = fs::path(filename).filename().string();
             string path = currentPath + "/" + cleanName;
             cout << "[LOG] GET request by " << username << " for " << path << endl;
-            sendFileToClient(clientSock, path);
+            rec.addBytes(0, sendFileToClient(clientSock, path));
+        } else if (cmd == "GETSPARSE") {
+            if (!authenticated) {
+                string msg = "ERROR: Not logged in\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            string filename;
+            iss >> filename;
+            if (filename.empty()) {
+                string msg = "ERROR: No filename\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            string cleanName = fs::path(filename).filename().string();
+            string path = currentPath + "/" + cleanName;
+            cout << "[LOG] GETSPARSE request by " << username << " for " << path << endl;
+            rec.addBytes(0, sendSparseToClient(clientSock, path));
         } else if (cmd == "GETALL") {
             if (!authenticated) {
                 string msg = "ERROR: Not logged in\n";
@@ -351,26 +1817,71 @@ void handleClient(int clientSock) {
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
-            // sanitize leading slash
-            if (rem.size() > 0 && rem[0] == '/') rem.erase(0, 1);
-            string path = BASE_DIR + rem;
+            string owner;
+            string path = resolveUserPath(rem, owner);
+            if (path.empty()) {
+                string msg = "ERROR: Bad remote path\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            UserHold ownerHold = owner == username ? nullptr : storageMap.holdUser(owner);
+            path = resolveUserPath(rem, owner); // may have moved while we waited
             cout << "[LOG] GETALL request by " << username << " for " << path << endl;
-            sendFileToClient(clientSock, path);
+            rec.addBytes(0, sendFileToClient(clientSock, path));
         } else if (cmd == "PWD") {
             if (!authenticated) {
                 string msg = "ERROR: Not logged in\n";
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
-            
-            string relativePath = "/";
-            if (currentPath.length() > userHomeDir.length()) {
-                relativePath += currentPath.substr(userHomeDir.length() + 1);
-            }
-            string msg = "OK\n" + relativePath + "\n";
+            string msg = "OK\n" + relativeDir(session) + "\n";
             send_all(clientSock, msg.c_str(), msg.size());
         } else if (cmd == "MKDIR") {
-                        if (!authenticated) {
+            if (!authenticated) {
+                string msg = "ERROR: Not logged in\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            string dirname;
+            iss >> dirname;
+            string err = makeDirectory(session, dirname);
+            string msg = err.empty() ? "OK\nDirectory created\n" : "ERROR: " + err + "\n";
+            send_all(clientSock, msg.c_str(), msg.size());
+        } else if (cmd == "DELETE") {
+            if (!authenticated) {
+                string msg = "ERROR: Not logged in\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            string filename;
+            iss >> filename;
+            string err = deleteFile(session, filename);
+            string msg = err.empty() ? "OK\nFile deleted\n" : "ERROR: " + err + "\n";
+            send_all(clientSock, msg.c_str(), msg.size());
+        } else if (cmd == "CD") {
+            if (!authenticated) {
+                string msg = "ERROR: Not logged in\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            string dirname;
+            iss >> dirname;
+            string err = changeDirectory(session, dirname);
+            string msg = err.empty() ? "OK\nDirectory changed\n" : "ERROR: " + err + "\n";
+            send_all(clientSock, msg.c_str(), msg.size());
+        } else if (cmd == "COPY" || cmd == "MOVE") {
+            if (!authenticated) {
+                string msg = "ERROR: Not logged in\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            string src, dst;
+            iss >> src >> dst;
+            string err = cmd == "COPY" ? copyFile(session, src, dst) : moveFile(session, src, dst);
+            string msg = err.empty() ? (cmd == "COPY" ? "OK\nFile copied\n" : "OK\nMoved\n") : "ERROR: " + err + "\n";
+            send_all(clientSock, msg.c_str(), msg.size());
+        } else if (cmd == "PUTDIR" || cmd == "GETDIR") {
+            if (!authenticated) {
                 string msg = "ERROR: Not logged in\n";
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
@@ -378,89 +1889,153 @@ void handleClient(int clientSock) {
             string dirname;
             iss >> dirname;
             if (dirname.empty()) {
-                string msg = "ERROR: No directory name specified\n";
+                string msg = "ERROR: No directory specified\n";
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
 
-            fs::path newDir = fs::path(currentPath) / dirname;
-            string newDirStr = newDir.lexically_normal().string();
-
-            if (newDirStr.rfind(userHomeDir, 0) != 0) {
+            fs::path dirPath = (fs::path(currentPath) / dirname).lexically_normal();
+            string dirStr = dirPath.string();
+            if (!pathWithin(dirStr, userHomeDir)) {
                  string msg = "ERROR: Permission denied\n";
                  send_all(clientSock, msg.c_str(), msg.size());
                  continue;
             }
 
-            if (fs::create_directory(newDir)) {
-                string msg = "OK\nDirectory created\n";
-                send_all(clientSock, msg.c_str(), msg.size());
-            } else {
+            if (cmd == "GETDIR") {
+                if (!fs::is_directory(dirPath)) {
+                    string msg = "ERROR: Directory not found\n";
+                    send_all(clientSock, msg.c_str(), msg.size());
+                    continue;
+                }
+                cout << "[LOG] GETDIR request by " << username << " for " << dirStr << endl;
+                tuneTransferSocket(clientSock, true);
+                sendDirToClient(clientSock, dirStr);
+                continue;
+            }
+
+            if (!createDirectories(username, dirPath)) {
                 string msg = "ERROR: Could not create directory\n";
                 send_all(clientSock, msg.c_str(), msg.size());
+                continue;
             }
-        } else if (cmd == "DELETE") {
+            tuneTransferSocket(clientSock, false);
+            string ready = "READY\n";
+            send_all(clientSock, ready.c_str(), ready.size());
+            receiveDirFromClient(clientSock, dirStr, username);
+        } else if (cmd == "PUTPACK") {
             if (!authenticated) {
                 string msg = "ERROR: Not logged in\n";
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
-            string filename;
-            iss >> filename;
-            if (filename.empty()) {
-                string msg = "ERROR: No filename specified\n";
+            size_t count = 0;
+            uint64_t totalBytes = 0;
+            if (!(iss >> count >> totalBytes) || count == 0) {
+                string msg = "ERROR: Wrong PUTPACK format\n";
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
-            
-            fs::path fileToDelete = fs::path(currentPath) / filename;
-            string fileStr = fileToDelete.lexically_normal().string();
-
-            if (fileStr.rfind(userHomeDir, 0) != 0) {
-                 string msg = "ERROR: Permission denied\n";
-                 send_all(clientSock, msg.c_str(), msg.size());
-                 continue;
+            if (totalBytes > PACK_MAX_BYTES) {
+                string msg = "ERROR: Pack too large\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
             }
-
-            if (fs::is_regular_file(fileToDelete) && fs::remove(fileToDelete)) {
-                string msg = "OK\nFile deleted\n";
+            tuneTransferSocket(clientSock, false);
+            string ready = "READY\n";
+            send_all(clientSock, ready.c_str(), ready.size());
+            receivePackFromClient(clientSock, currentPath, count, totalBytes, username);
+        } else if (cmd == "GETPACK") {
+            if (!authenticated) {
+                string msg = "ERROR: Not logged in\n";
                 send_all(clientSock, msg.c_str(), msg.size());
-            } else {
-                string msg = "ERROR: File not found or could not be deleted\n";
+                continue;
+            }
+            vector<string> names;
+            string n;
+            while (iss >> n) names.push_back(n);
+            if (names.empty()) {
+                string msg = "ERROR: No filename\n";
                 send_all(clientSock, msg.c_str(), msg.size());
+                continue;
             }
-        } else if (cmd == "CD") {
+            tuneTransferSocket(clientSock, true);
+            sendPackToClient(clientSock, currentPath, names);
+        } else if (cmd == "USAGE") {
             if (!authenticated) {
                 string msg = "ERROR: Not logged in\n";
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
-            string dirname;
-            iss >> dirname;
-            if (dirname.empty()) {
-                string msg = "ERROR: No directory specified\n";
+            sendTextBlock(clientSock, usageReport(username));
+        } else if (cmd == "FIND") {
+            if (!authenticated) {
+                string msg = "ERROR: Not logged in\n";
                 send_all(clientSock, msg.c_str(), msg.size());
                 continue;
             }
-
-            fs::path newPath = fs::path(currentPath) / dirname;
-            newPath = newPath.lexically_normal();
-            string newPathStr = newPath.string();
-
-            if (newPathStr.rfind(userHomeDir, 0) != 0) {
-                 string msg = "ERROR: Permission denied\n";
-                 send_all(clientSock, msg.c_str(), msg.size());
-                 continue;
+            string rest, err;
+            getline(iss, rest);
+            string result = findReport(rest, err);
+            if (!err.empty()) {
+                string msg = "ERROR: " + err + "\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
             }
-
-            if (fs::exists(newPath) && fs::is_directory(newPath)) {
-                currentPath = newPathStr;
-                string msg = "OK\nDirectory changed\n";
+            sendTextBlock(clientSock, result);
+        } else if (cmd == "STATS") {
+            if (!authenticated) {
+                string msg = "ERROR: Not logged in\n";
                 send_all(clientSock, msg.c_str(), msg.size());
-            } else {
-                string msg = "ERROR: Directory not found\n";
+                continue;
+            }
+            sendTextBlock(clientSock, serverStats());
+        } else if (cmd == "PROTO") {
+            string version;
+            iss >> version;
+            if (version != "2") {
+                string msg = "ERROR: Unsupported protocol version\n";
                 send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            string msg = string(PROTO_HELLO) + "\n";
+            send_all(clientSock, msg.c_str(), msg.size());
+            busy.release();
+            hold.reset();
+            traceCmd.end();
+            rec.end();
+            handleClientV2(clientSock, session);
+            break;
+        } else if (cmd == "WATCH") {
+            if (!authenticated) {
+                string msg = "ERROR: Not logged in\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            string dir, root;
+            iss >> dir;
+            string err = watchRoot(session, dir, root);
+            if (!err.empty()) {
+                string msg = "ERROR: " + err + "\n";
+                send_all(clientSock, msg.c_str(), msg.size());
+                continue;
+            }
+            // subscribe before the OK, so nothing after it is missed
+            shared_ptr<Watch> w = watchHub.subscribe(root);
+            string msg = "OK\nWatching " + (root.empty() ? string("/") : root) + "\n";
+            if (!send_all(clientSock, msg.c_str(), msg.size())) {
+                watchHub.unsubscribe(w);
+                break;
             }
+            // from here the session only waits: no stall timeout, no hold on the home
+            busy.release();
+            hold.reset();
+            traceCmd.end();
+            rec.end();
+            cout << "[LOG] WATCH by " << username << " on " << (root.empty() ? "/" : root) << endl;
+            bool keep = watchLoop(clientSock, *w);
+            watchHub.unsubscribe(w);
+            if (!keep) break;
         } else if (cmd == "EXIT") {
             break;
         } else {
@@ -469,6 +2044,9 @@ void handleClient(int clientSock) {
         }
     }
 
+    recorder.endSession(session.recordId);
+    sessionRegistry.remove(slot);
+    bindSessionSlot(nullptr);
     close(clientSock);
-    cout << "[LOG] Client disconnected\n";
+    cout << "[LOG] Client disconnected" << (slot->reaped ? " (reaped)" : "") << "\n";
 }
\ No newline at end of file
@@ -1,8 +1,26 @@
 #include "ftp_server.h"
+#include "file_cache.h"
+#include "path_index.h"
+#include "quota.h"
+#include "session_registry.h"
+#include "storage_map.h"
+#include "trace.h"
+#include "session_recorder.h"
+#include "watch_hub.h"
+#include "auth.h"
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cstring>
 #include <filesystem>
@@ -10,62 +28,463 @@
 #include <iostream>
 #include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <vector>
 
-int main(int argc, char *argv[]) {
-    int port = 2121;
-    if (argc >= 2) port = stoi(argv[1]);
+static void printUsage(const char *prog) {
+    cout << "Usage: " << prog << " [port] [options]\n"
+         << "  --shards <n|auto>   listening sockets with SO_REUSEPORT, one acceptor each (default 1)\n"
+         << "  --pin-cpus          pin each acceptor and its sessions to a core\n"
+         << "  --cpus <a,b,...>    cores to pin to (implies --pin-cpus)\n"
+         << "  --backlog <n>       listen backlog per socket (default 128)\n"
+         << "  --fsync <never|always|large>  flush uploads before rename (default large)\n"
+         << "  --fsync-min-mb <n>  size from which --fsync large flushes (default 64)\n"
+         << "  --direct-io-min-mb <n>  write uploads of at least n MB with O_DIRECT (default off)\n"
+         << "  --cache-mb <n>      memory for hot GET/GETALL files, 0 disables (default 64)\n"
+         << "  --cache-max-file-kb <n>  largest file kept in the cache (default 1024)\n"
+         << "  --quota-mb <n>      default per-user quota, 0 = unlimited (overrides in server/quotas.txt)\n"
+         << "  --idle-timeout <s>  close sessions idle between commands this long, 0 = never (default 300)\n"
+         << "  --stall-timeout <s> close sessions whose transfer made no progress this long, 0 = never (default 60)\n"
+         << "  --keepalive <idle,interval,count|off>  TCP keepalive probing (default 60,10,5)\n"
+         << "  --upload-buffers <n>  256 KB buffers between receiving and writing a PUT, 1 = no write-behind (default 4)\n"
+         << "  --download-buffers <n>  256 KB chunks a GET reads ahead on a prefetch thread, 1 = inline reads (default 4)\n"
+         << "  --trace <file>      write per-command spans as Chrome trace JSON (chrome://tracing, Perfetto);\n"
+         << "                      the file is overwritten, a process started by SIGHUP writes <file>.<pid>\n"
+         << "  --trace-sample <f>  fraction of commands traced, 0..1 (default 1)\n"
+         << "  --record <file>     append every session's commands, timings and payload sizes (for ftp_replay)\n"
+         << "  --sndbuf <bytes>    socket send buffer for downloads, 0 = kernel autotuning (default 0)\n"
+         << "  --rcvbuf <bytes>    socket receive buffer for uploads, 0 = kernel autotuning (default 0)\n"
+         << "  --auth-iterations <n>  PBKDF2-SHA256 cost of stored passwords; weaker entries are rehashed at login (default 50000)\n"
+         << "  --auth-threads <n>  threads hashing passwords for LOGIN/REGISTER (default: half the cores)\n"
+         << "  --watch-batch-ms <n>  time WATCH collects events into one batch (default 100)\n"
+         << "  --watch-max-pending <n>  paths queued per WATCH before it is told to RESYNC (default 1024)\n"
+         << "  --drain-timeout <s> on SIGTERM/SIGINT/SIGHUP, time given to running sessions (default 30)\n"
+         << "SIGTERM or SIGINT: stop accepting, drain sessions, exit.\n"
+         << "SIGHUP: start a new server process on the same listening sockets, then drain this one.\n"
+         << "SIGUSR1: reload server/storage.conf and migrate users whose storage root changed.\n";
+}
 
-    ensureDir(SERVER_ROOT);
-    ensureDir(BASE_DIR);
-    // ensure users file exists
-    {
-        lock_guard<mutex> lock(usersMutex);
-        if (!fs::exists(USERS_FILE)) {
-            ofstream f(USERS_FILE);
-            f.close();
+static bool parseArgs(int argc, char *argv[], ServerConfig &cfg) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        auto next = [&](string &val) {
+            if (i + 1 >= argc) return false;
+            val = argv[++i];
+            return true;
+        };
+        string val;
+        try {
+            if (arg == "--shards") {
+                if (!next(val)) return false;
+                if (val == "auto") cfg.shards = (int)max(1u, thread::hardware_concurrency());
+                else cfg.shards = stoi(val);
+            } else if (arg == "--pin-cpus") {
+                cfg.pinCpus = true;
+            } else if (arg == "--cpus") {
+                if (!next(val)) return false;
+                istringstream ss(val);
+                string c;
+                while (getline(ss, c, ',')) cfg.cpus.push_back(stoi(c));
+                cfg.pinCpus = true;
+            } else if (arg == "--backlog") {
+                if (!next(val)) return false;
+                cfg.backlog = stoi(val);
+            } else if (arg == "--fsync") {
+                if (!next(val)) return false;
+                if (val == "never") cfg.fsync = FsyncPolicy::Never;
+                else if (val == "always") cfg.fsync = FsyncPolicy::Always;
+                else if (val == "large") cfg.fsync = FsyncPolicy::Large;
+                else throw invalid_argument(val);
+            } else if (arg == "--fsync-min-mb") {
+                if (!next(val)) return false;
+                cfg.fsyncMinBytes = stoull(val) << 20;
+            } else if (arg == "--direct-io-min-mb") {
+                if (!next(val)) return false;
+                cfg.directIoMinBytes = stoull(val) << 20;
+            } else if (arg == "--cache-mb") {
+                if (!next(val)) return false;
+                cfg.cacheBytes = stoull(val) << 20;
+            } else if (arg == "--cache-max-file-kb") {
+                if (!next(val)) return false;
+                cfg.cacheMaxFileBytes = stoull(val) << 10;
+            } else if (arg == "--quota-mb") {
+                if (!next(val)) return false;
+                cfg.defaultQuotaBytes = stoull(val) << 20;
+            } else if (arg == "--idle-timeout") {
+                if (!next(val)) return false;
+                cfg.idleTimeoutSec = stoi(val);
+            } else if (arg == "--stall-timeout") {
+                if (!next(val)) return false;
+                cfg.stallTimeoutSec = stoi(val);
+            } else if (arg == "--keepalive") {
+                if (!next(val)) return false;
+                if (val == "off") {
+                    cfg.keepaliveIdleSec = 0;
+                } else {
+                    char c1, c2;
+                    istringstream ss(val);
+                    if (!(ss >> cfg.keepaliveIdleSec >> c1 >> cfg.keepaliveIntervalSec >> c2 >> cfg.keepaliveCount) || c1 != ',' || c2 != ',')
+                        throw invalid_argument(val);
+                }
+            } else if (arg == "--upload-buffers") {
+                if (!next(val)) return false;
+                cfg.uploadPipelineDepth = stoi(val);
+            } else if (arg == "--download-buffers") {
+                if (!next(val)) return false;
+                cfg.downloadPipelineDepth = stoi(val);
+            } else if (arg == "--trace") {
+                if (!next(val)) return false;
+                cfg.traceFile = val;
+            } else if (arg == "--trace-sample") {
+                if (!next(val)) return false;
+                cfg.traceSampleRate = stod(val);
+                if (cfg.traceSampleRate < 0 || cfg.traceSampleRate > 1) throw invalid_argument(val);
+            } else if (arg == "--record") {
+                if (!next(val)) return false;
+                cfg.recordFile = val;
+            } else if (arg == "--sndbuf") {
+                if (!next(val)) return false;
+                cfg.sendBufferBytes = stoi(val);
+            } else if (arg == "--rcvbuf") {
+                if (!next(val)) return false;
+                cfg.recvBufferBytes = stoi(val);
+            } else if (arg == "--auth-iterations") {
+                if (!next(val)) return false;
+                cfg.authIterations = stoi(val);
+                if (cfg.authIterations < 1) throw invalid_argument(val);
+            } else if (arg == "--auth-threads") {
+                if (!next(val)) return false;
+                cfg.authThreads = stoi(val);
+                if (cfg.authThreads < 1) throw invalid_argument(val);
+            } else if (arg == "--watch-batch-ms") {
+                if (!next(val)) return false;
+                cfg.watchBatchMs = stoi(val);
+                if (cfg.watchBatchMs < 0) throw invalid_argument(val);
+            } else if (arg == "--watch-max-pending") {
+                if (!next(val)) return false;
+                cfg.watchMaxPending = stoull(val);
+                if (cfg.watchMaxPending < 1) throw invalid_argument(val);
+            } else if (arg == "--drain-timeout") {
+                if (!next(val)) return false;
+                cfg.drainTimeoutSec = stoi(val);
+            } else if (arg == "-h" || arg == "--help") {
+                return false;
+            } else if (!arg.empty() && arg[0] != '-') {
+                cfg.port = stoi(arg);
+            } else {
+                cerr << "Unknown option: " << arg << "\n";
+                return false;
+            }
+        } catch (...) {
+            cerr << "Bad value for " << arg << "\n";
+            return false;
         }
     }
+    if (cfg.shards < 1) cfg.shards = 1;
+    return true;
+}
 
-    int serverSock = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSock < 0) {
+// create a bound, listening socket; with reusePort several of them can share the port
+static int openListenSocket(int port, bool reusePort) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
         cerr << "Socket create failed\n";
-        return 1;
+        return -1;
     }
 
     int opt = 1;
-    setsockopt(serverSock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reusePort && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        cerr << "SO_REUSEPORT not supported\n";
+        close(sock);
+        return -1;
+    }
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
     addr.sin_addr.s_addr = INADDR_ANY;
 
-    if (bind(serverSock, (sockaddr *)&addr, sizeof(addr)) < 0) {
+    if (bind(sock, (sockaddr *)&addr, sizeof(addr)) < 0) {
         cerr << "Bind failed\n";
-        close(serverSock);
-        return 1;
+        close(sock);
+        return -1;
     }
-    if (listen(serverSock, 10) < 0) {
+    if (listen(sock, serverConfig.backlog) < 0) {
         cerr << "Listen failed\n";
-        close(serverSock);
-        return 1;
+        close(sock);
+        return -1;
     }
+    return sock;
+}
+
+// pin the calling thread; threads it creates afterwards inherit the mask
+static void pinToCpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) cerr << "Cannot pin to cpu " << cpu << ": " << strerror(rc) << "\n";
+}
+
+// dead peers behind NATs never send a FIN: probe them, and bound how long
+// unacknowledged data may sit in the send queue
+static void setKeepalive(int sock) {
+    if (serverConfig.keepaliveIdleSec <= 0) return;
+    int on = 1;
+    int idle = serverConfig.keepaliveIdleSec;
+    int intvl = serverConfig.keepaliveIntervalSec;
+    int cnt = serverConfig.keepaliveCount;
+    unsigned int userTimeout = (unsigned int)(idle + intvl * cnt) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt));
+    setsockopt(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeout, sizeof(userTimeout));
+}
+
+// restarted processes find their inherited listening sockets here, e.g. "3,4"
+#define LISTEN_FDS_ENV "FTP_LISTEN_FDS"
+// write end of a pipe: the new process writes one byte once it accepts
+#define READY_FD_ENV "FTP_READY_FD"
+
+// readable once the server stops accepting
+static int stopPipe[2] = {-1, -1};
 
-    cout << "[LOG] FTP server started on port " << port << endl;
+// one acceptor per listening socket; sessions run on detached threads in the same shard.
+// Listening sockets are non-blocking: during a restart two processes poll them.
+static void runAcceptor(int listenSock, int shard) {
+    if (serverConfig.pinCpus) {
+        int cpu = serverConfig.cpus.empty()
+                      ? shard % (int)max(1u, thread::hardware_concurrency())
+                      : serverConfig.cpus[shard % serverConfig.cpus.size()];
+        pinToCpu(cpu);
+        cout << "[LOG] Acceptor " << shard << " pinned to cpu " << cpu << endl;
+    }
 
+    pollfd fds[2] = {{listenSock, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
     while (true) {
-        int clientSock = accept(serverSock, nullptr, nullptr);
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Poll failed\n";
+            break;
+        }
+        if (fds[1].revents) break;
+        int clientSock = accept4(listenSock, nullptr, nullptr, SOCK_CLOEXEC);
         if (clientSock < 0) {
-            cerr << "Accept failed\n";
+            if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) cerr << "Accept failed\n";
             continue;
         }
-        cout << "[LOG] Client connected\n";
+        setKeepalive(clientSock);
+        cout << "[LOG] Client connected (shard " << shard << ")\n";
         thread t(handleClient, clientSock);
         t.detach();
     }
+}
+
+// listening sockets left by the process that exec'd us, empty on a normal start
+static vector<int> inheritedListenSockets() {
+    vector<int> socks;
+    const char *env = getenv(LISTEN_FDS_ENV);
+    if (!env) return socks;
+    istringstream ss(env);
+    string item;
+    while (getline(ss, item, ',')) {
+        int fd = atoi(item.c_str());
+        int listening = 0;
+        socklen_t len = sizeof(listening);
+        if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == 0 && listening) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            socks.push_back(fd);
+        } else {
+            cerr << "Ignoring inherited fd " << fd << ": not a listening socket\n";
+        }
+    }
+    unsetenv(LISTEN_FDS_ENV);
+    return socks;
+}
+
+// fork+exec this binary with the listening sockets as the only open fds and
+// wait until it accepts. On failure the new process is killed and we keep serving.
+static bool restartProcess(char *argv[], const vector<int> &listenSocks) {
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) < 0) return false;
+
+    string fdList;
+    for (int fd : listenSocks) fdList += (fdList.empty() ? "" : ",") + to_string(fd);
+    // everything the child needs is prepared here: after fork only async-signal-safe calls
+    vector<string> envStrings;
+    for (char **e = environ; *e; ++e) {
+        string kv = *e;
+        if (kv.rfind(LISTEN_FDS_ENV "=", 0) == 0 || kv.rfind(READY_FD_ENV "=", 0) == 0) continue;
+        envStrings.push_back(kv);
+    }
+    envStrings.push_back(string(LISTEN_FDS_ENV) + "=" + fdList);
+    envStrings.push_back(string(READY_FD_ENV) + "=" + to_string(ready[1]));
+    vector<char *> envp;
+    for (auto &kv : envStrings) envp.push_back(&kv[0]);
+    envp.push_back(nullptr);
+    // the binary currently at our path, so a deploy that replaced it takes effect
+    char exe[4096];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (n <= 0) {
+        close(ready[0]);
+        close(ready[1]);
+        return false;
+    }
+    string exePath(exe, (size_t)n);
+    const string deleted = " (deleted)";
+    if (exePath.size() > deleted.size() && exePath.compare(exePath.size() - deleted.size(), deleted.size(), deleted) == 0)
+        exePath.resize(exePath.size() - deleted.size());
+    vector<int> keep(listenSocks);
+    keep.push_back(ready[1]);
+    sort(keep.begin(), keep.end());
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(ready[0]);
+        close(ready[1]);
+        return false;
+    }
+    if (pid == 0) {
+        unsigned int next = 3;
+        for (int fd : keep) {
+            if ((unsigned int)fd > next) close_range(next, fd - 1, 0);
+            fcntl(fd, F_SETFD, 0);
+            next = fd + 1;
+        }
+        close_range(next, ~0U, 0);
+        execve(exePath.c_str(), argv, envp.data());
+        _exit(127);
+    }
+
+    close(ready[1]);
+    pollfd p = {ready[0], POLLIN, 0};
+    char c = 0;
+    bool ok = poll(&p, 1, 10000) > 0 && read(ready[0], &c, 1) == 1 && c == 'R';
+    close(ready[0]);
+    if (!ok) {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        return false;
+    }
+    cout << "[LOG] New server process " << pid << " is accepting" << endl;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (!parseArgs(argc, argv, serverConfig)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // a send on a reaped or vanished peer must fail with EPIPE, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    // SIGTERM/SIGINT drain and exit, SIGHUP restarts, SIGUSR1 rebalances storage; all are taken by sigwait
+    // below, so block them before any thread exists
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    fileCache.setLimits(serverConfig.cacheBytes, serverConfig.cacheMaxFileBytes);
+    if (!serverConfig.traceFile.empty()) {
+        // after a SIGHUP restart the old process is still writing the file it
+        // was given; this one gets its own, "<file>.<pid>"
+        string tracePath = serverConfig.traceFile;
+        if (getenv(LISTEN_FDS_ENV)) tracePath += "." + to_string(getpid());
+        if (!tracer.start(tracePath, serverConfig.traceSampleRate)) return 1;
+    }
+    if (!serverConfig.recordFile.empty() && !recorder.start(serverConfig.recordFile)) return 1;
+
+    ensureDir(SERVER_ROOT);
+    ensureDir(BASE_DIR);
+    // ensure users file exists
+    {
+        lock_guard<mutex> lock(usersMutex);
+        if (!fs::exists(USERS_FILE)) {
+            ofstream f(USERS_FILE);
+            f.close();
+        }
+    }
+
+    usageLedger.setDefaultQuota(serverConfig.defaultQuotaBytes);
+    usageLedger.loadQuotaFile(QUOTAS_FILE);
+    storageMap.load(STORAGE_FILE, PLACEMENT_FILE, BASE_DIR);
+    usageLedger.scan(storageMap.homes());
+    pathIndex.scan(storageMap.homes());
+    watchHub.setMaxPending(serverConfig.watchMaxPending);
+
+    sessionRegistry.startReaper(serverConfig.idleTimeoutSec, serverConfig.stallTimeoutSec);
+    int authThreads = serverConfig.authThreads ? serverConfig.authThreads : (int)max(1u, thread::hardware_concurrency() / 2);
+    authPool.start(authThreads, AUTH_MAX_QUEUED);
+
+    vector<int> listenSocks = inheritedListenSockets();
+    bool inherited = !listenSocks.empty();
+    bool reusePort = inherited ? listenSocks.size() > 1 : serverConfig.shards > 1;
+    for (int i = 0; !inherited && i < serverConfig.shards; ++i) {
+        int s = openListenSocket(serverConfig.port, reusePort);
+        if (s < 0) {
+            for (int o : listenSocks) close(o);
+            return 1;
+        }
+        listenSocks.push_back(s);
+    }
+    for (int s : listenSocks) fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+    if (pipe2(stopPipe, O_CLOEXEC) < 0) {
+        cerr << "Pipe failed\n";
+        return 1;
+    }
+
+    cout << "[LOG] FTP server started on port " << serverConfig.port;
+    if (reusePort) cout << " with " << listenSocks.size() << " SO_REUSEPORT shards";
+    if (inherited) cout << " (listening sockets inherited)";
+    cout << endl;
+
+    vector<thread> acceptors;
+    for (int i = 0; i < (int)listenSocks.size(); ++i) {
+        acceptors.emplace_back(runAcceptor, listenSocks[i], i);
+    }
+
+    // tell the old process it can stop accepting
+    if (const char *readyFd = getenv(READY_FD_ENV)) {
+        int fd = atoi(readyFd);
+        if (write(fd, "R", 1) != 1) cerr << "Cannot report ready\n";
+        close(fd);
+        unsetenv(READY_FD_ENV);
+    }
+
+    while (true) {
+        int sig = 0;
+        if (sigwait(&sigs, &sig) != 0) continue;
+        if (sig == SIGUSR1) {
+            // migrations copy whole homes: keep the signal loop free
+            thread(&StorageMap::rebalance, &storageMap).detach();
+            continue;
+        }
+        if (sig != SIGHUP) break;
+        cout << "[LOG] Restart requested: handing the listening sockets to a new process" << endl;
+        if (restartProcess(argv, listenSocks)) break;
+        cerr << "Restart failed, still serving\n";
+    }
+
+    // stop accepting; queued connections stay in the backlog for the new process
+    cout << "[LOG] Shutting down, draining sessions (deadline " << serverConfig.drainTimeoutSec << "s)" << endl;
+    if (write(stopPipe[1], "x", 1) != 1) cerr << "Cannot stop acceptors\n";
+    for (auto &t : acceptors) t.join();
+    for (int s : listenSocks) close(s);
 
-    close(serverSock);
-    return 0;
+    size_t left = sessionRegistry.drain(serverConfig.drainTimeoutSec);
+    sessionRegistry.stopReaper();
+    authPool.stop();
+    tracer.stop();
+    recorder.stop();
+    cout << "[LOG] Server stopped" << (left ? " with " + to_string(left) + " sessions cut" : "") << endl;
+    // detached session threads may still be unwinding: skip static destructors
+    _exit(0);
 }
\ No newline at end of file
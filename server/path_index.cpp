@@ -0,0 +1,91 @@
+#include "path_index.h"
+#include "ftp_server.h"
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <iostream>
+
+PathIndex pathIndex;
+
+static bool statEntry(const string &fullPath, IndexEntry &e) {
+    struct stat st;
+    if (stat(fullPath.c_str(), &st) != 0) return false;
+    if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) return false;
+    e.isDir = S_ISDIR(st.st_mode);
+    e.size = e.isDir ? 0 : (uint64_t)st.st_size;
+    e.mtime = st.st_mtime;
+    return true;
+}
+
+void PathIndex::scan(const map<string, string> &homes) {
+    map<string, IndexEntry> fresh;
+    error_code ec;
+    for (auto &home : homes) {
+        fs::path base(home.second);
+        IndexEntry e;
+        if (statEntry(home.second, e)) fresh[home.first] = e;
+        for (auto it = fs::recursive_directory_iterator(base, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            if (it->path().filename().string().rfind(UPLOAD_TMP_PREFIX, 0) == 0) continue;
+            if (statEntry(it->path().string(), e)) {
+                fresh[home.first + "/" + it->path().lexically_relative(base).generic_string()] = e;
+            }
+        }
+        ec.clear();
+    }
+    unique_lock<shared_mutex> lock(mtx);
+    entries.swap(fresh);
+    cout << "[LOG] Path index: " << entries.size() << " entries\n";
+}
+
+void PathIndex::refresh(const string &key, const string &fullPath) {
+    IndexEntry e;
+    bool exists = statEntry(fullPath, e);
+    unique_lock<shared_mutex> lock(mtx);
+    if (exists) entries[key] = e;
+    else entries.erase(key);
+}
+
+void PathIndex::removeTree(const string &key) {
+    unique_lock<shared_mutex> lock(mtx);
+    entries.erase(key);
+    string prefix = key + "/";
+    auto it = entries.lower_bound(prefix);
+    while (it != entries.end() && it->first.compare(0, prefix.size(), prefix) == 0) it = entries.erase(it);
+}
+
+size_t PathIndex::size() {
+    shared_lock<shared_mutex> lock(mtx);
+    return entries.size();
+}
+
+vector<pair<string, IndexEntry>> PathIndex::find(const FindQuery &q, size_t &total) {
+    vector<pair<string, IndexEntry>> page;
+    total = 0;
+
+    // prefix queries, and globs that start with literal text, only scan the
+    // key range that can match
+    string literal;
+    if (q.mode == FindMode::Prefix) {
+        literal = q.pattern;
+    } else if (q.mode == FindMode::Glob) {
+        size_t w = q.pattern.find_first_of("*?[\\");
+        literal = q.pattern.substr(0, w);
+    }
+
+    shared_lock<shared_mutex> lock(mtx);
+    for (auto it = entries.lower_bound(literal); it != entries.end(); ++it) {
+        const string &key = it->first;
+        const IndexEntry &e = it->second;
+        if (!literal.empty() && key.compare(0, literal.size(), literal) != 0) break;
+
+        if (q.mode == FindMode::Substring && key.find(q.pattern) == string::npos) continue;
+        if (q.mode == FindMode::Glob && fnmatch(q.pattern.c_str(), key.c_str(), 0) != 0) continue;
+        if (q.filesOnly && e.isDir) continue;
+        if (e.size < q.minSize || e.size > q.maxSize) continue;
+        if (q.newerThan && e.mtime <= q.newerThan) continue;
+        if (q.olderThan && e.mtime >= q.olderThan) continue;
+
+        if (total >= q.offset && page.size() < q.limit) page.emplace_back(key, e);
+        ++total;
+    }
+    return page;
+}
\ No newline at end of file
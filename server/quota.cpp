@@ -0,0 +1,94 @@
+#include "quota.h"
+#include "ftp_server.h"
+#include <fstream>
+#include <iostream>
+
+UsageLedger usageLedger;
+
+void UsageLedger::scan(const map<string, string> &homes) {
+    unordered_map<string, UserUsage> fresh;
+    error_code ec;
+    for (auto &home : homes) {
+        UserUsage &usage = fresh[home.first];
+        for (auto it = fs::recursive_directory_iterator(home.second, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            if (it->path().filename().string().rfind(UPLOAD_TMP_PREFIX, 0) == 0) continue;
+            if (it->is_directory(ec)) {
+                ++usage.dirs;
+            } else if (it->is_regular_file(ec)) {
+                ++usage.files;
+                usage.bytes += it->file_size(ec);
+            }
+        }
+        ec.clear();
+    }
+    lock_guard<mutex> lock(mtx);
+    users.swap(fresh);
+    cout << "[LOG] Usage ledger: " << users.size() << " users scanned\n";
+}
+
+void UsageLedger::loadQuotaFile(const string &path) {
+    ifstream in(path);
+    string user;
+    uint64_t mb;
+    lock_guard<mutex> lock(mtx);
+    while (in >> user >> mb) quotas[user] = mb << 20;
+}
+
+uint64_t UsageLedger::quotaLocked(const string &user) const {
+    auto it = quotas.find(user);
+    return it != quotas.end() ? it->second : defaultQuota;
+}
+
+uint64_t UsageLedger::quota(const string &user) {
+    lock_guard<mutex> lock(mtx);
+    return quotaLocked(user);
+}
+
+bool UsageLedger::reserve(const string &user, uint64_t fsize, uint64_t replacedBytes, uint64_t &reserved) {
+    reserved = fsize > replacedBytes ? fsize - replacedBytes : 0;
+    lock_guard<mutex> lock(mtx);
+    UserUsage &u = users[user];
+    uint64_t limit = quotaLocked(user);
+    if (limit > 0 && reserved > 0 && u.bytes + u.reserved + reserved > limit) {
+        reserved = 0;
+        return false;
+    }
+    u.reserved += reserved;
+    return true;
+}
+
+void UsageLedger::release(const string &user, uint64_t reserved) {
+    if (reserved == 0) return;
+    lock_guard<mutex> lock(mtx);
+    UserUsage &u = users[user];
+    u.reserved -= min(u.reserved, reserved);
+}
+
+void UsageLedger::fileStored(const string &user, uint64_t newSize, int64_t replacedSize) {
+    lock_guard<mutex> lock(mtx);
+    UserUsage &u = users[user];
+    if (replacedSize < 0) {
+        ++u.files;
+    } else {
+        u.bytes -= min<uint64_t>(u.bytes, (uint64_t)replacedSize);
+    }
+    u.bytes += newSize;
+}
+
+void UsageLedger::fileRemoved(const string &user, uint64_t size) {
+    lock_guard<mutex> lock(mtx);
+    UserUsage &u = users[user];
+    u.bytes -= min(u.bytes, size);
+    if (u.files > 0) --u.files;
+}
+
+void UsageLedger::dirCreated(const string &user) {
+    lock_guard<mutex> lock(mtx);
+    ++users[user].dirs;
+}
+
+UserUsage UsageLedger::usage(const string &user) {
+    lock_guard<mutex> lock(mtx);
+    auto it = users.find(user);
+    return it != users.end() ? it->second : UserUsage();
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "session_recorder.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+
+SessionRecorder recorder;
+
+int64_t recordClock() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool SessionRecorder::start(const string &path) {
+    // append: a SIGHUP restart keeps writing the same recording, and with
+    // O_APPEND each flush of whole lines lands after the other process's
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        cerr << "Cannot open recording file " << path << "\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size == 0) pending = "# ftp-record 1\n";
+    // session ids stay unique across processes appending to one file
+    sessionBase = (uint64_t)getpid() * 1000000;
+    on = true;
+    cout << "[LOG] Recording sessions to " << path << "\n";
+    return true;
+}
+
+void SessionRecorder::stop() {
+    if (!on) return;
+    lock_guard<mutex> lock(mtx);
+    on = false;
+    flushLocked();
+    close(fd);
+    fd = -1;
+}
+
+// one write() per flush, so a concurrent appender never splits a line
+void SessionRecorder::flushLocked() {
+    size_t done = 0;
+    while (done < pending.size()) {
+        ssize_t w = write(fd, pending.data() + done, pending.size() - done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        done += (size_t)w;
+    }
+    pending.clear();
+}
+
+uint64_t SessionRecorder::newSession() {
+    if (!enabled()) return 0;
+    return sessionBase + ++nextSession;
+}
+
+void SessionRecorder::endSession(uint64_t session) {
+    if (session == 0) return;
+    record(session, recordClock(), 0, 0, 0, "END", "");
+    lock_guard<mutex> lock(mtx);
+    if (fd >= 0) flushLocked();
+}
+
+void SessionRecorder::record(uint64_t session, int64_t startUs, int64_t durUs, uint64_t bytesIn, uint64_t bytesOut,
+                             const string &verb, const string &args) {
+    // one line, no embedded newlines
+    string a = args;
+    for (char &ch : a) {
+        if (ch == '\n' || ch == '\r') ch = ' ';
+    }
+    char head[128];
+    snprintf(head, sizeof(head), "%llu %lld %lld %llu %llu ", (unsigned long long)session, (long long)startUs,
+             (long long)durUs, (unsigned long long)bytesIn, (unsigned long long)bytesOut);
+    lock_guard<mutex> lock(mtx);
+    if (fd < 0) return;
+    pending += head;
+    pending += verb;
+    if (!a.empty()) pending += " " + a;
+    pending += '\n';
+    if (pending.size() >= RECORD_FLUSH_BYTES) flushLocked();
+}
+
+RecordCommand::RecordCommand(uint64_t session, const string &verb, const string &args)
+    : session(recorder.enabled() ? session : 0) {
+    if (this->session == 0) return;
+    this->verb = verb;
+    // LOGIN/REGISTER: keep the user name, drop the password
+    if (verb == "LOGIN" || verb == "REGISTER") this->args = args.substr(0, args.find(' '));
+    else this->args = args;
+    start = recordClock();
+}
+
+void RecordCommand::addBytes(uint64_t in, uint64_t out) {
+    bytesIn += in;
+    bytesOut += out;
+}
+
+void RecordCommand::end() {
+    if (session == 0) return;
+    recorder.record(session, start, recordClock() - start, bytesIn, bytesOut, verb, args);
+    session = 0;
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "session_registry.h"
+#include <sys/socket.h>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+SessionRegistry sessionRegistry;
+
+static thread_local shared_ptr<SessionSlot> threadSlot;
+
+static int64_t nowMs() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void bindSessionSlot(const shared_ptr<SessionSlot> &slot) {
+    threadSlot = slot;
+}
+
+shared_ptr<SessionSlot> currentSessionSlot() {
+    return threadSlot;
+}
+
+void sessionActivity() {
+    SessionSlot *s = threadSlot.get();
+    if (s) s->lastActive.store(nowMs(), memory_order_relaxed);
+}
+
+SessionBusy::SessionBusy() : slot(threadSlot.get()) {
+    if (slot) {
+        slot->busy.fetch_add(1);
+        slot->lastActive.store(nowMs(), memory_order_relaxed);
+    }
+}
+
+SessionBusy::~SessionBusy() {
+    release();
+}
+
+void SessionBusy::release() {
+    if (!slot) return;
+    slot->lastActive.store(nowMs(), memory_order_relaxed);
+    slot->busy.fetch_sub(1);
+    slot = nullptr;
+}
+
+shared_ptr<SessionSlot> SessionRegistry::add(int sock) {
+    auto slot = make_shared<SessionSlot>();
+    slot->sock = sock;
+    slot->lastActive = nowMs();
+    ++accepted;
+    lock_guard<mutex> lock(mtx);
+    slots[slot.get()] = slot;
+    return slot;
+}
+
+void SessionRegistry::remove(const shared_ptr<SessionSlot> &slot) {
+    lock_guard<mutex> lock(mtx);
+    slots.erase(slot.get());
+    if (drainFlag) cv.notify_all();
+}
+
+void SessionRegistry::startReaper(int idleSec, int stallSec) {
+    idleMs = (int64_t)idleSec * 1000;
+    stallMs = (int64_t)stallSec * 1000;
+    if (idleMs == 0 && stallMs == 0) return;
+    reaper = thread(&SessionRegistry::reapLoop, this);
+}
+
+void SessionRegistry::stopReaper() {
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    if (reaper.joinable()) reaper.join();
+}
+
+// scan a few times per timeout, at most once a second
+void SessionRegistry::reapLoop() {
+    int64_t shortest = idleMs && stallMs ? min(idleMs, stallMs) : max(idleMs, stallMs);
+    auto period = chrono::milliseconds(max<int64_t>(50, min<int64_t>(1000, shortest / 4)));
+    unique_lock<mutex> lock(mtx);
+    while (!cv.wait_for(lock, period, [this] { return stopping; })) {
+        int64_t now = nowMs();
+        for (auto &kv : slots) {
+            SessionSlot &s = *kv.first;
+            if (s.reaped) continue;
+            bool inCommand = s.busy.load() > 0;
+            int64_t limit = inCommand ? stallMs : idleMs;
+            if (limit == 0 || now - s.lastActive.load(memory_order_relaxed) < limit) continue;
+            // the owning thread still closes the fd; shutdown only wakes it
+            s.reaped = true;
+            shutdown(s.sock, SHUT_RDWR);
+            if (inCommand) ++reapedStall;
+            else ++reapedIdle;
+            cout << "[LOG] Reaped " << (inCommand ? "stalled" : "idle") << " session (fd " << s.sock << ")\n";
+        }
+    }
+}
+
+size_t SessionRegistry::drain(int timeoutSec) {
+    drainFlag = true;
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(timeoutSec);
+    auto hardStop = deadline + chrono::seconds(1); // time for the cut sessions to unwind
+    size_t lastLeft = SIZE_MAX;
+    unique_lock<mutex> lock(mtx);
+    while (!slots.empty() && chrono::steady_clock::now() < hardStop) {
+        bool force = chrono::steady_clock::now() >= deadline;
+        for (auto &kv : slots) {
+            SessionSlot &s = *kv.first;
+            if (s.reaped || (!force && s.busy.load() > 0)) continue;
+            s.reaped = true;
+            shutdown(s.sock, SHUT_RDWR);
+        }
+        if (slots.size() != lastLeft) {
+            lastLeft = slots.size();
+            cout << "[LOG] Draining: " << lastLeft << " sessions left" << (force ? " (deadline passed)" : "") << endl;
+        }
+        cv.wait_for(lock, chrono::milliseconds(100));
+    }
+    return slots.size();
+}
+
+size_t SessionRegistry::active() {
+    lock_guard<mutex> lock(mtx);
+    return slots.size();
+}
+
+string SessionRegistry::stats() {
+    return "sessions_active " + to_string(active()) + "\n" +
+           "sessions_accepted " + to_string(accepted.load()) + "\n" +
+           "sessions_reaped_idle " + to_string(reapedIdle.load()) + "\n" +
+           "sessions_reaped_stall " + to_string(reapedStall.load()) + "\n";
+}
\ No newline at end of file
@@ -0,0 +1,317 @@
+#include "storage_map.h"
+#include "ftp_server.h"
+#include "file_cache.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+StorageMap storageMap;
+
+// ring points per unit of weight; enough to keep shares within a few percent
+#define RING_POINTS 128
+
+// helper: FNV-1a, stable across builds and platforms unlike std::hash
+static uint64_t ringHash(const string &s) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    // murmur3 finalizer: names differing in one character must land far apart
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static string normalizeRoot(const string &dir) {
+    string p = fs::path(dir).lexically_normal().string();
+    if (p.empty() || p.back() != '/') p += '/';
+    return p;
+}
+
+static bool tempName(const fs::path &p) {
+    return p.filename().string().rfind(UPLOAD_TMP_PREFIX, 0) == 0;
+}
+
+// make dst an exact copy of src (files, dirs, mtimes), copying only what differs.
+// Run once while the user is still active and once more under the exclusive lock.
+static bool syncTree(const fs::path &src, const fs::path &dst, string &err) {
+    error_code ec;
+    fs::create_directories(dst, ec);
+    for (auto it = fs::recursive_directory_iterator(src, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (tempName(it->path())) continue;
+        fs::path target = dst / it->path().lexically_relative(src);
+        error_code fec;
+        if (it->is_directory(fec)) {
+            fs::create_directories(target, fec);
+            continue;
+        }
+        if (!it->is_regular_file(fec)) continue;
+        uint64_t size = it->file_size(fec);
+        auto mtime = it->last_write_time(fec);
+        error_code tec;
+        if (fs::is_regular_file(target, tec) && fs::file_size(target, tec) == size && fs::last_write_time(target, tec) == mtime) continue;
+        if (!fs::copy_file(it->path(), target, fs::copy_options::overwrite_existing, fec)) {
+            err = "Cannot copy " + it->path().string() + ": " + fec.message();
+            return false;
+        }
+        fs::last_write_time(target, mtime, fec);
+    }
+    if (ec) {
+        err = "Cannot read " + src.string() + ": " + ec.message();
+        return false;
+    }
+    // drop what disappeared from src since the last pass
+    vector<fs::path> stale;
+    for (auto it = fs::recursive_directory_iterator(dst, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        error_code sec;
+        if (!fs::exists(src / it->path().lexically_relative(dst), sec)) stale.push_back(it->path());
+    }
+    for (auto &p : stale) fs::remove_all(p, ec);
+    return true;
+}
+
+void StorageMap::loadConf() {
+    vector<StorageRoot> newRoots;
+    unordered_map<string, string> newPins;
+    ifstream in(confPath);
+    string line;
+    while (getline(in, line)) {
+        istringstream ss(line);
+        string kind;
+        ss >> kind;
+        if (kind == "root") {
+            StorageRoot r;
+            string dir;
+            ss >> dir;
+            if (dir.empty()) continue;
+            if (!(ss >> r.weight) || r.weight == 0) r.weight = 1;
+            r.path = normalizeRoot(dir);
+            newRoots.push_back(r);
+        } else if (kind == "pin") {
+            string user, dir;
+            if (ss >> user >> dir) newPins[user] = normalizeRoot(dir);
+        }
+    }
+    if (newRoots.empty()) {
+        StorageRoot r;
+        r.path = fallbackRoot;
+        newRoots.push_back(r);
+    }
+    map<uint64_t, string> newRing;
+    for (auto &r : newRoots) {
+        ensureDir(r.path);
+        for (unsigned i = 0; i < RING_POINTS * r.weight; ++i) newRing[ringHash(r.path + "#" + to_string(i))] = r.path;
+    }
+    lock_guard<mutex> lock(mtx);
+    roots.swap(newRoots);
+    ring.swap(newRing);
+    pins.swap(newPins);
+}
+
+void StorageMap::load(const string &confFile, const string &placementFile, const string &defaultRoot) {
+    confPath = confFile;
+    placementPath = placementFile;
+    fallbackRoot = normalizeRoot(defaultRoot);
+    loadConf();
+
+    // later lines win: registration appends, migration rewrites the whole file
+    unordered_map<string, string> known;
+    ifstream in(placementPath);
+    string line;
+    while (getline(in, line)) {
+        size_t sp = line.find(' ');
+        if (sp == string::npos || sp == 0) continue;
+        known[line.substr(0, sp)] = normalizeRoot(line.substr(sp + 1));
+    }
+
+    // homes on any root that placement.txt does not know yet (first start on
+    // this layout, or a root added by hand) stay where they are
+    set<string> scanRoots = {fallbackRoot};
+    for (auto &r : roots) scanRoots.insert(r.path);
+    for (auto &kv : known) scanRoots.insert(kv.second);
+    size_t found = 0;
+    for (auto &root : scanRoots) {
+        error_code ec;
+        for (auto &u : fs::directory_iterator(root, ec)) {
+            if (!u.is_directory(ec)) continue;
+            string user = u.path().filename().string();
+            auto it = known.find(user);
+            if (it == known.end()) {
+                known[user] = root;
+                ++found;
+            } else if (it->second != root) {
+                cout << "[LOG] Storage: ignoring stale copy of " << user << " on " << root << "\n";
+            }
+        }
+    }
+
+    lock_guard<mutex> lock(mtx);
+    placement.swap(known);
+    savePlacement();
+    cout << "[LOG] Storage: " << roots.size() << " roots, " << placement.size() << " users placed";
+    if (found) cout << " (" << found << " found by scan)";
+    cout << "\n";
+}
+
+string StorageMap::ringRoot(const string &user) {
+    auto pin = pins.find(user);
+    if (pin != pins.end()) return pin->second;
+    auto it = ring.lower_bound(ringHash(user));
+    if (it == ring.end()) it = ring.begin();
+    return it->second;
+}
+
+void StorageMap::savePlacement() {
+    string tmp = placementPath + ".tmp";
+    {
+        ofstream out(tmp, ios::trunc);
+        for (auto &kv : placement) out << kv.first << " " << kv.second << "\n";
+        if (!out) {
+            cerr << "Cannot write " << tmp << "\n";
+            return;
+        }
+    }
+    if (rename(tmp.c_str(), placementPath.c_str()) != 0) cerr << "Cannot replace " << placementPath << "\n";
+}
+
+string StorageMap::homeOf(const string &user) {
+    lock_guard<mutex> lock(mtx);
+    auto it = placement.find(user);
+    return (it != placement.end() ? it->second : ringRoot(user)) + user;
+}
+
+string StorageMap::placeNewUser(const string &user) {
+    lock_guard<mutex> lock(mtx);
+    auto it = placement.find(user);
+    if (it != placement.end()) return it->second + user;
+    string root = ringRoot(user);
+    placement[user] = root;
+    ofstream out(placementPath, ios::app);
+    out << user << " " << root << "\n";
+    return root + user;
+}
+
+map<string, string> StorageMap::homes() {
+    lock_guard<mutex> lock(mtx);
+    map<string, string> out;
+    for (auto &kv : placement) out[kv.first] = kv.second + kv.first;
+    return out;
+}
+
+bool StorageMap::keyOf(const string &path, string &key) {
+    string norm = fs::path(path).lexically_normal().string();
+    lock_guard<mutex> lock(mtx);
+    // try every "<dir>/" prefix as the root: it counts only if the component
+    // after it is a user placed on exactly that root (copies being built are not)
+    for (size_t slash = norm.find('/'); slash != string::npos; slash = norm.find('/', slash + 1)) {
+        size_t end = norm.find('/', slash + 1);
+        string user = norm.substr(slash + 1, end == string::npos ? string::npos : end - slash - 1);
+        auto it = placement.find(user);
+        if (it != placement.end() && it->second.size() == slash + 1 && norm.compare(0, slash + 1, it->second) == 0) {
+            key = norm.substr(slash + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+shared_ptr<shared_mutex> StorageMap::userLock(const string &user) {
+    lock_guard<mutex> lock(mtx);
+    auto &l = userLocks[user];
+    if (!l) l = make_shared<shared_mutex>();
+    return l;
+}
+
+UserHold StorageMap::holdUser(const string &user) {
+    shared_ptr<shared_mutex> l = userLock(user);
+    // the lock object stays alive as long as someone holds it
+    auto hold = shared_ptr<shared_lock<shared_mutex>>(new shared_lock<shared_mutex>(*l), [l](shared_lock<shared_mutex> *h) { delete h; });
+    return hold;
+}
+
+bool StorageMap::migrate(const string &user, const string &rootDir, string &err) {
+    string root = normalizeRoot(rootDir);
+    string src;
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = placement.find(user);
+        if (it == placement.end()) {
+            err = "Unknown user";
+            return false;
+        }
+        if (it->second == root) return true;
+        src = it->second + user;
+    }
+    string dst = root + user;
+    ensureDir(root);
+    error_code ec;
+    fs::remove_all(dst, ec); // left over from an interrupted migration
+
+    auto switchTo = [&]() {
+        lock_guard<mutex> lock(mtx);
+        placement[user] = root;
+        savePlacement();
+    };
+
+    shared_ptr<shared_mutex> l = userLock(user);
+    {
+        unique_lock<shared_mutex> excl(*l);
+        if (rename(src.c_str(), dst.c_str()) == 0) {
+            switchTo();
+        } else if (errno != EXDEV) {
+            err = "Cannot move " + src + ": " + strerror(errno);
+            return false;
+        } else {
+            excl.unlock();
+            // bulk copy while the user keeps working, then the delta under the lock
+            if (!syncTree(src, dst, err)) return false;
+            excl.lock();
+            if (!syncTree(src, dst, err)) return false;
+            switchTo();
+            excl.unlock();
+            fs::remove_all(src, ec);
+        }
+    }
+    fileCache.invalidatePrefix(src + "/");
+    ++migrated;
+    cout << "[LOG] Storage: migrated " << user << " from " << src << " to " << dst << endl;
+    return true;
+}
+
+void StorageMap::rebalance() {
+    if (rebalancing.exchange(true)) return;
+    loadConf();
+    vector<pair<string, string>> moves;
+    {
+        lock_guard<mutex> lock(mtx);
+        for (auto &kv : placement) {
+            string target = ringRoot(kv.first);
+            if (target != kv.second) moves.push_back({kv.first, target});
+        }
+    }
+    cout << "[LOG] Storage: rebalance moves " << moves.size() << " users" << endl;
+    for (auto &m : moves) {
+        string err;
+        if (!migrate(m.first, m.second, err)) cerr << "Migration of " << m.first << " failed: " << err << "\n";
+    }
+    rebalancing = false;
+}
+
+string StorageMap::stats() {
+    lock_guard<mutex> lock(mtx);
+    map<string, size_t> perRoot;
+    for (auto &r : roots) perRoot[r.path] = 0;
+    for (auto &kv : placement) ++perRoot[kv.second];
+    string out;
+    for (auto &kv : perRoot) out += "storage_root " + kv.first + " users " + to_string(kv.second) + "\n";
+    out += "storage_migrations " + to_string(migrated.load()) + "\n";
+    return out;
+}
\ No newline at end of file
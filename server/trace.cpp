@@ -0,0 +1,166 @@
+#include "trace.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+Tracer tracer;
+
+static thread_local bool threadSampled = false;
+
+static int64_t steadyMicros() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// helper: JSON string escaping for command lines and paths
+static string jsonEscape(const string &s) {
+    string out;
+    out.reserve(s.size());
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+    return out;
+}
+
+bool Tracer::start(const string &path, double sampleRate) {
+    out = fopen(path.c_str(), "w");
+    if (!out) {
+        cerr << "Cannot open trace file " << path << "\n";
+        return false;
+    }
+    fputs("[\n", out);
+    rate = sampleRate;
+    pid = (int)getpid();
+    origin = steadyMicros();
+    on = true;
+    flusher = thread(&Tracer::flushLoop, this);
+    cout << "[LOG] Tracing to " << path << " (sample rate " << rate << ")\n";
+    return true;
+}
+
+void Tracer::stop() {
+    if (!on) return;
+    stopping = true;
+    if (flusher.joinable()) flusher.join();
+    on = false;
+    flushAll();
+    fputs("\n]\n", out);
+    fclose(out);
+    out = nullptr;
+}
+
+int64_t Tracer::now() const {
+    return steadyMicros() - origin;
+}
+
+bool Tracer::sample() {
+    if (!enabled()) return false;
+    if (rate >= 1.0) return true;
+    static thread_local minstd_rand rng(random_device{}());
+    return uniform_real_distribution<double>(0.0, 1.0)(rng) < rate;
+}
+
+TraceBuffer &Tracer::threadBuffer() {
+    static thread_local shared_ptr<TraceBuffer> mine;
+    if (!mine) {
+        mine = make_shared<TraceBuffer>();
+        mine->tid = (int)syscall(SYS_gettid);
+        lock_guard<mutex> lock(bufsMtx);
+        buffers.push_back(mine);
+    }
+    return *mine;
+}
+
+void Tracer::record(TraceEvent &&e) {
+    TraceBuffer &b = threadBuffer();
+    lock_guard<mutex> lock(b.mtx);
+    b.events.push_back(move(e));
+}
+
+void Tracer::flushLoop() {
+    while (!stopping) {
+        this_thread::sleep_for(chrono::seconds(1));
+        flushAll();
+    }
+}
+
+void Tracer::flushAll() {
+    vector<shared_ptr<TraceBuffer>> bufs;
+    {
+        lock_guard<mutex> lock(bufsMtx);
+        // buffers of finished session threads go once they are written out
+        vector<shared_ptr<TraceBuffer>> alive;
+        for (auto &b : buffers) {
+            bufs.push_back(b);
+            if (b.use_count() > 2) alive.push_back(b);
+        }
+        buffers.swap(alive);
+    }
+    for (auto &b : bufs) {
+        vector<TraceEvent> events;
+        {
+            lock_guard<mutex> lock(b->mtx);
+            events.swap(b->events);
+        }
+        for (auto &e : events) {
+            fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d,\"args\":{",
+                    first ? "" : ",\n", jsonEscape(e.name).c_str(), e.cat, (long long)e.ts, (long long)e.dur, pid, b->tid);
+            first = false;
+            const char *sep = "";
+            if (e.bytes) {
+                fprintf(out, "\"bytes\":%llu", (unsigned long long)e.bytes);
+                sep = ",";
+            }
+            if (!e.detail.empty()) fprintf(out, "%s\"detail\":\"%s\"", sep, jsonEscape(e.detail).c_str());
+            fputs("}}", out);
+        }
+    }
+    fflush(out);
+}
+
+bool traceSampled() {
+    return threadSampled;
+}
+
+TraceInherit::TraceInherit(bool sampled) : saved(threadSampled) {
+    threadSampled = sampled;
+}
+
+TraceInherit::~TraceInherit() {
+    threadSampled = saved;
+}
+
+TraceSpan::TraceSpan(const char *name, const char *cat, uint64_t bytes)
+    : active(threadSampled), cat(cat), bytes(bytes) {
+    if (!active) return;
+    this->name = name;
+    start = tracer.now();
+}
+
+void TraceSpan::end() {
+    if (!active) return;
+    active = false;
+    int64_t stop = tracer.now();
+    tracer.record(TraceEvent{move(name), cat, start, stop - start, bytes, move(detail)});
+}
+
+TraceCommand::TraceCommand(const char *name, const string &detail)
+    : scope(tracer.sample()), span(name, "command") {
+    span.setDetail(detail);
+}
+
+void TraceCommand::end() {
+    if (ended) return;
+    ended = true;
+    span.end();
+}
\ No newline at end of file
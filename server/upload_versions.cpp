@@ -0,0 +1,56 @@
+#include "upload_versions.h"
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+UploadVersions uploadVersions;
+
+UploadVersions::Stripe &UploadVersions::stripeOf(const string &key) {
+    return stripes[hash<string>()(key) % UPLOAD_VERSION_STRIPES];
+}
+
+void UploadVersions::release(Stripe &s, unordered_map<string, PathState>::iterator it) {
+    if (--it->second.inFlight == 0) s.paths.erase(it);
+}
+
+uint64_t UploadVersions::claim(const string &path) {
+    string key = fs::path(path).lexically_normal().string();
+    Stripe &s = stripeOf(key);
+    lock_guard<mutex> lock(s.mtx);
+    ++s.paths[key].inFlight;
+    // taken under the lock, so per path the versions follow the claim order
+    return ++nextVersion;
+}
+
+bool UploadVersions::finish(const string &path, uint64_t version, const function<void()> &publish) {
+    string key = fs::path(path).lexically_normal().string();
+    Stripe &s = stripeOf(key);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.paths.find(key);
+    if (it == s.paths.end()) {
+        // never claimed: nothing to order it against
+        publish();
+        return true;
+    }
+    bool newest = version > it->second.committed;
+    if (newest) {
+        publish();
+        it->second.committed = version;
+    } else {
+        ++superseded;
+    }
+    release(s, it);
+    return newest;
+}
+
+void UploadVersions::abandon(const string &path) {
+    string key = fs::path(path).lexically_normal().string();
+    Stripe &s = stripeOf(key);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.paths.find(key);
+    if (it != s.paths.end()) release(s, it);
+}
+
+string UploadVersions::stats() {
+    return "uploads_superseded " + to_string(superseded.load()) + "\n";
+}
\ No newline at end of file
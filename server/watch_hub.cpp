@@ -0,0 +1,91 @@
+#include "watch_hub.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+
+WatchHub watchHub;
+
+Watch::Watch(const string &root, size_t maxPending)
+    : root(root), maxPending(maxPending), efd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+Watch::~Watch() {
+    if (efd >= 0) close(efd);
+}
+
+bool Watch::add(const string &key, char kind) {
+    lock_guard<mutex> lock(mtx);
+    if (overflow) return true; // the subscriber re-lists anyway
+    bool wake = pending.empty();
+    pending[key] = kind;
+    bool ok = true;
+    if (pending.size() > maxPending) {
+        pending.clear();
+        overflow = true;
+        ok = false;
+    }
+    if (wake) {
+        uint64_t one = 1;
+        (void)!write(efd, &one, sizeof(one));
+    }
+    return ok;
+}
+
+void Watch::take(map<string, char> &events, bool &resync) {
+    lock_guard<mutex> lock(mtx);
+    events.clear();
+    events.swap(pending);
+    resync = overflow;
+    overflow = false;
+    uint64_t count;
+    (void)!read(efd, &count, sizeof(count));
+}
+
+shared_ptr<Watch> WatchHub::subscribe(const string &root) {
+    auto w = make_shared<Watch>(root, maxPending);
+    lock_guard<mutex> lock(mtx);
+    byUser[root.substr(0, root.find('/'))].push_back(w);
+    ++watchers;
+    return w;
+}
+
+void WatchHub::unsubscribe(const shared_ptr<Watch> &w) {
+    lock_guard<mutex> lock(mtx);
+    auto it = byUser.find(w->root.substr(0, w->root.find('/')));
+    if (it == byUser.end()) return;
+    auto &list = it->second;
+    auto pos = find(list.begin(), list.end(), w);
+    if (pos == list.end()) return;
+    list.erase(pos);
+    if (list.empty()) byUser.erase(it);
+    --watchers;
+}
+
+// helper: does a change of path (no trailing '/') concern the subtree at root?
+// A removed ancestor does: the watched directory went with it.
+static bool touches(const string &root, const string &path, char kind) {
+    if (root.empty() || path == root) return true;
+    if (path.size() > root.size() && path.compare(0, root.size(), root) == 0 && path[root.size()] == '/') return true;
+    return kind == 'D' && root.size() > path.size() && root.compare(0, path.size(), path) == 0 && root[path.size()] == '/';
+}
+
+void WatchHub::publish(const string &key, char kind) {
+    if (!active()) return;
+    string path = key.back() == '/' ? key.substr(0, key.size() - 1) : key;
+    string user = path.substr(0, path.find('/'));
+    ++published;
+    lock_guard<mutex> lock(mtx);
+    for (const string &bucket : {user, string()}) {
+        auto it = byUser.find(bucket);
+        if (it == byUser.end()) continue;
+        for (auto &w : it->second) {
+            if (touches(w->root, path, kind) && !w->add(key, kind)) ++resyncs;
+        }
+        if (user.empty()) break; // same bucket twice
+    }
+}
+
+string WatchHub::stats() {
+    return "watch_sessions " + to_string(watchers.load()) + "\n" +
+           "watch_events " + to_string(published.load()) + "\n" +
+           "watch_resyncs " + to_string(resyncs.load()) + "\n";
+}
\ No newline at end of file